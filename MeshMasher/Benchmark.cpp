@@ -0,0 +1,391 @@
+// Benchmark.cpp : MeshMasherBench, benchmarks run against the models listed in contents.txt
+// run from the executable directory like MeshMasher so contents.txt and input are found
+//
+#include "Codec.h"
+#include "Kernels.h"
+#include "MeshMasher.h"
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+#include <assimp/Importer.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// run func until at least minSeconds have passed and return the average seconds per run
+template <typename Func>
+double measure(Func&& func, double minSeconds = 0.2) {
+	unsigned int runs = 0;
+	auto start = std::chrono::steady_clock::now();
+	double elapsed = 0.0;
+	do {
+		func();
+		runs++;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (elapsed < minSeconds);
+	return elapsed / runs;
+}
+
+std::vector<std::string> readContents() {
+	std::vector<std::string> modelNames;
+	std::ifstream fileContents("contents.txt", std::ios::in);
+	std::string modelName;
+	while (std::getline(fileContents, modelName)) {
+		if (!modelName.empty())
+			modelNames.push_back(modelName);
+	}
+	return modelNames;
+}
+
+void printThroughput(const std::string& modelName, const char* kernel, const char* level, size_t bytes, double seconds) {
+	std::cout << std::left << std::setw(24) << modelName << std::setw(14) << kernel << std::setw(8) << level
+		<< std::right << std::fixed << std::setprecision(1) << std::setw(10) << (bytes / seconds) / (1024.0 * 1024.0) << " MB/s" << std::endl;
+}
+
+// per kernel throughput of every available instruction set level, measured in output bytes
+void benchKernels() {
+	std::cout << "ingest kernels, runtime level " << getKernelLevelName(getKernelLevel()) << std::endl;
+	for (auto& fileName : readContents()) {
+		Assimp::Importer importer;
+		const auto scene = importer.ReadFile(("input/" + fileName).c_str(), aiProcessPreset_TargetRealtime_Quality | aiProcess_PreTransformVertices);
+		if (scene == nullptr) {
+			std::cout << "Error: '" << fileName << "' not found. Skipping......." << std::endl;
+			continue;
+		}
+
+		size_t maxVertices = 0, maxFaces = 0, numVertices = 0, numFaces = 0;
+		for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+			maxVertices = std::max<size_t>(maxVertices, scene->mMeshes[i]->mNumVertices);
+			maxFaces = std::max<size_t>(maxFaces, scene->mMeshes[i]->mNumFaces);
+			numVertices += scene->mMeshes[i]->mNumVertices;
+			numFaces += scene->mMeshes[i]->mNumFaces;
+		}
+		std::vector<Vertex> vertices(maxVertices);
+		std::vector<unsigned int> indices(maxFaces * 3);
+
+		for (int l = 0; l <= static_cast<int>(getKernelLevel()); l++) {
+			auto level = static_cast<KernelLevel>(l);
+			double seconds = measure([&]() {
+				for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+					const aiMesh* aimesh = scene->mMeshes[i];
+					interleaveVertices(level, vertices.data(), aimesh->mVertices, aimesh->mTextureCoords[0], aimesh->mNormals, aimesh->mNumVertices);
+				}
+				});
+			printThroughput(fileName, "interleave", getKernelLevelName(level), numVertices * sizeof(Vertex), seconds);
+
+			seconds = measure([&]() {
+				for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+					flattenFaces(level, indices.data(), scene->mMeshes[i]->mFaces, scene->mMeshes[i]->mNumFaces);
+				});
+			printThroughput(fileName, "flatten", getKernelLevelName(level), numFaces * 3 * sizeof(unsigned int), seconds);
+		}
+
+		// bounds read the interleaved vertices, measured in input bytes
+		Bounds bounds;
+		double seconds = measure([&]() {
+			for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+				computeBounds(vertices.data(), scene->mMeshes[i]->mNumVertices, bounds);
+			});
+		printThroughput(fileName, "bounds", "sse", numVertices * sizeof(Vertex), seconds);
+	}
+}
+
+// indexed grid of quads in the xz plane with a little height so triangles have a real spatial spread
+aiScene* makeGridScene(size_t numTriangles) {
+	unsigned int quads = static_cast<unsigned int>(std::ceil(std::sqrt(numTriangles / 2.0)));
+	unsigned int side = quads + 1;
+
+	aiMesh* aimesh = new aiMesh();
+	aimesh->mPrimitiveTypes = aiPrimitiveType_TRIANGLE;
+	aimesh->mNumVertices = side * side;
+	aimesh->mVertices = new aiVector3D[aimesh->mNumVertices];
+	aimesh->mNormals = new aiVector3D[aimesh->mNumVertices];
+	aimesh->mTextureCoords[0] = new aiVector3D[aimesh->mNumVertices];
+	aimesh->mNumUVComponents[0] = 2;
+	for (unsigned int z = 0; z < side; z++) {
+		for (unsigned int x = 0; x < side; x++) {
+			unsigned int v = z * side + x;
+			aimesh->mVertices[v] = aiVector3D(static_cast<float>(x), std::sin(x * 0.1f) * std::cos(z * 0.1f), static_cast<float>(z));
+			aimesh->mNormals[v] = aiVector3D(0.f, 1.f, 0.f);
+			aimesh->mTextureCoords[0][v] = aiVector3D(x / static_cast<float>(quads), z / static_cast<float>(quads), 0.f);
+		}
+	}
+
+	aimesh->mNumFaces = quads * quads * 2;
+	aimesh->mFaces = new aiFace[aimesh->mNumFaces];
+	unsigned int f = 0;
+	for (unsigned int z = 0; z < quads; z++) {
+		for (unsigned int x = 0; x < quads; x++) {
+			unsigned int v = z * side + x;
+			unsigned int corners[2][3] = { { v, v + side, v + 1 }, { v + 1, v + side, v + side + 1 } };
+			for (auto& corner : corners) {
+				aimesh->mFaces[f].mNumIndices = 3;
+				aimesh->mFaces[f].mIndices = new unsigned int[3] { corner[0], corner[1], corner[2] };
+				f++;
+			}
+		}
+	}
+
+	aiScene* scene = new aiScene();
+	scene->mNumMeshes = 1;
+	scene->mMeshes = new aiMesh*[1] { aimesh };
+	scene->mNumMaterials = 1;
+	scene->mMaterials = new aiMaterial*[1] { new aiMaterial() };
+	scene->mRootNode = new aiNode();
+	scene->mRootNode->mNumMeshes = 1;
+	scene->mRootNode->mMeshes = new unsigned int[1] { 0 };
+	return scene;
+}
+
+// time to process one huge synthetic mesh for growing worker counts, whole mesh per task vs split into chunks
+void benchScaling(size_t numTriangles) {
+	std::unique_ptr<aiScene> scene(makeGridScene(numTriangles));
+	std::cout << "synthetic grid, " << scene->mMeshes[0]->mNumFaces << " triangles, " << scene->mMeshes[0]->mNumVertices << " vertices" << std::endl;
+
+	std::vector<unsigned int> workerCounts;
+	unsigned int maxWorkers = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned int w = 1; w < maxWorkers; w *= 2)
+		workerCounts.push_back(w);
+	workerCounts.push_back(maxWorkers);
+
+	double baseline = 0.0;
+	std::vector<std::string> rows;
+	for (bool split : { false, true }) {
+		for (auto workers : workerCounts) {
+			Settings settings;
+			settings.numWorkerThreads = workers;
+			if (!split)
+				settings.chunkTriangles = 0;
+
+			MeshMasher masher(settings);
+			masher.startWorkers();
+			auto start = std::chrono::steady_clock::now();
+			masher.processModel(scene.get(), "Synthetic");
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			masher.stopWorkers();
+
+			if (baseline == 0.0)
+				baseline = seconds;
+			std::ostringstream row;
+			row << std::left << std::setw(10) << (split ? "chunked" : "whole") << std::right << std::setw(8) << workers << " workers"
+				<< std::fixed << std::setprecision(3) << std::setw(10) << seconds << " s" << std::setprecision(2) << std::setw(8) << baseline / seconds << "x";
+			rows.push_back(row.str());
+		}
+	}
+
+	std::cout << std::endl << std::left << std::setw(10) << "mode" << std::right << std::setw(16) << "workers" << std::setw(12) << "time" << std::setw(9) << "speedup" << std::endl;
+	for (auto& row : rows)
+		std::cout << row << std::endl;
+}
+
+// assimp import time of every sample model with the full realtime quality preset vs the lean preset used with -mo 1
+void benchImport() {
+	Settings quality, lean;
+	quality.useMeshOptimizer = false;
+	unsigned int qualityFlags = MeshMasher(quality).getImportFlags(), leanFlags = MeshMasher(lean).getImportFlags();
+
+	std::cout << std::left << std::setw(24) << "model" << std::right << std::setw(12) << "quality" << std::setw(12) << "lean" << std::setw(10) << "saved" << std::endl;
+	for (auto& fileName : readContents()) {
+		std::string path = "input/" + fileName;
+		bool found = true;
+		auto import = [&](unsigned int flags) {
+			Assimp::Importer importer;
+			found = importer.ReadFile(path.c_str(), flags) != nullptr;
+		};
+
+		double qualitySeconds = measure([&]() { import(qualityFlags); }, 1.0);
+		if (!found) {
+			std::cout << "Error: '" << fileName << "' not found. Skipping......." << std::endl;
+			continue;
+		}
+		double leanSeconds = measure([&]() { import(leanFlags); }, 1.0);
+
+		std::cout << std::left << std::setw(24) << fileName << std::right << std::fixed << std::setprecision(3)
+			<< std::setw(10) << qualitySeconds << " s" << std::setw(10) << leanSeconds << " s"
+			<< std::setprecision(1) << std::setw(9) << 100.0 * (1.0 - leanSeconds / qualitySeconds) << "%" << std::endl;
+	}
+}
+
+// worker idle time of processing every sample model with the tasks pushed in scene order vs largest estimated cost first
+void benchSchedule() {
+	unsigned int workers = std::max(2u, std::thread::hardware_concurrency());
+	std::cout << "task scheduling, " << workers << " workers" << std::endl;
+
+	std::vector<std::string> rows;
+	for (auto& fileName : readContents()) {
+		Assimp::Importer importer;
+		const auto scene = importer.ReadFile(("input/" + fileName).c_str(), MeshMasher().getImportFlags());
+		if (scene == nullptr) {
+			std::cout << "Error: '" << fileName << "' not found. Skipping......." << std::endl;
+			continue;
+		}
+
+		for (bool largestFirst : { false, true }) {
+			Settings settings;
+			settings.numWorkerThreads = workers;
+			settings.largestFirst = largestFirst;
+
+			MeshMasher masher(settings);
+			masher.startWorkers();
+			masher.processModel(scene, fileName.substr(0, fileName.find('.')));
+			masher.stopWorkers();
+
+			auto stats = masher.getWorkerStats();
+			double idleSeconds = std::max(0.0, stats.workerSeconds - stats.busySeconds);
+			std::ostringstream row;
+			row << std::left << std::setw(24) << fileName << std::setw(14) << (largestFirst ? "largest first" : "scene order") << std::right << std::fixed
+				<< std::setprecision(3) << std::setw(10) << stats.workerSeconds / workers << " s" << std::setw(10) << idleSeconds << " s"
+				<< std::setprecision(1) << std::setw(8) << (stats.workerSeconds > 0.0 ? 100.0 * idleSeconds / stats.workerSeconds : 0.0) << "%";
+			rows.push_back(row.str());
+		}
+	}
+
+	std::cout << std::endl << std::left << std::setw(24) << "model" << std::setw(14) << "order" << std::right << std::setw(12) << "wall" << std::setw(12) << "idle" << std::setw(9) << "idle%" << std::endl;
+	for (auto& row : rows)
+		std::cout << row << std::endl;
+}
+
+// time to write one large synthetic buffer the size of a big scene's dat.vbf + dat.ebf: one std::ofstream stream as before the
+// parallel writes vs 4 MB blocks written by every thread through each OutputFile backend. buffered writes only reach the page cache
+void benchWrite(size_t megabytes) {
+	std::vector<char> data(megabytes << 20);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = static_cast<char>(i * 31 + (i >> 12));
+	const char* path = "output/bench.tmp";
+	const size_t blockSize = 1 << 22;
+	unsigned int workers = std::max(2u, std::thread::hardware_concurrency());
+	std::cout << "writing " << megabytes << " MB, " << workers << " threads" << std::endl;
+
+	auto writeBlocks = [&](WriteBackend backend, bool directIo, const char* name) {
+		bool ok = true, direct = false;
+		double seconds = measure([&]() {
+			OutputFile file;
+			if (!file.open(path, data.size(), backend, directIo)) {
+				ok = false;
+				return;
+			}
+			ok = file.getBackend() == backend;
+			direct = file.isDirect();
+
+			std::atomic<size_t> next(0);
+			{
+				std::vector<std::jthread> threads;
+				for (unsigned int t = 0; t < workers; t++) {
+					threads.emplace_back([&]() {
+						for (size_t block = next.fetch_add(blockSize); block < data.size(); block = next.fetch_add(blockSize))
+							file.write(block, data.data() + block, std::min(blockSize, data.size() - block));
+					});
+				}
+			}
+			ok = file.close() && ok;
+		}, 0.0);
+
+		std::cout << std::left << std::setw(20) << name << std::right << std::fixed << std::setprecision(3) << std::setw(10) << seconds << " s"
+			<< std::setprecision(0) << std::setw(10) << megabytes / seconds << " MB/s";
+		if (!ok)
+			std::cout << "  (backend not available, fell back to sync)";
+		else if (directIo && !direct)
+			std::cout << "  (O_DIRECT not supported here, buffered)";
+		std::cout << std::endl;
+	};
+
+	double streamSeconds = measure([&]() {
+		std::ofstream ofile(path, std::fstream::out | std::fstream::binary);
+		ofile.write(data.data(), data.size());
+		ofile.flush();
+	}, 0.0);
+	std::cout << std::left << std::setw(20) << "ofstream" << std::right << std::fixed << std::setprecision(3) << std::setw(10) << streamSeconds << " s"
+		<< std::setprecision(0) << std::setw(10) << megabytes / streamSeconds << " MB/s" << std::endl;
+
+	writeBlocks(WriteBackend::Sync, false, "sync");
+	writeBlocks(WriteBackend::Uring, false, "uring");
+	writeBlocks(WriteBackend::Uring, true, "uring O_DIRECT");
+	std::remove(path);
+}
+
+// ratio and single thread throughput of every -lz level on the files of an uncompressed run in output/, cut into the
+// same chunks MeshMasher compresses on its workers. chunks are independent, so both directions scale with the threads
+void benchCompress() {
+	for (const char* name : { "vbf", "ebf", "rgb" }) {
+		std::ifstream ifile(std::string("output/dat.") + name, std::ios::in | std::ios::binary);
+		std::vector<char> data((std::istreambuf_iterator<char>(ifile)), std::istreambuf_iterator<char>());
+		if (data.empty()) {
+			std::cout << "output/dat." << name << " is missing or empty, run MeshMasher with -lz 0 first" << std::endl;
+			continue;
+		}
+
+		std::vector<std::vector<char>> chunks((data.size() + CompressedChunkSize - 1) / CompressedChunkSize);
+		std::vector<char> decompressed(data.size());
+		for (int level = MinCompressionLevel; level <= MaxCompressionLevel; level++) {
+			size_t compressedBytes = 0;
+			double compressSeconds = measure([&]() {
+				compressedBytes = 0;
+				for (size_t c = 0; c < chunks.size(); c++) {
+					size_t rawSize = std::min<size_t>(CompressedChunkSize, data.size() - c * CompressedChunkSize);
+					chunks[c].resize(getCompressBound(rawSize));
+					chunks[c].resize(compressBlock(data.data() + c * CompressedChunkSize, rawSize, chunks[c].data(), chunks[c].size(), level));
+					compressedBytes += chunks[c].size();
+				}
+			}, 0.0);
+
+			bool ok = true;
+			double decompressSeconds = measure([&]() {
+				for (size_t c = 0; c < chunks.size(); c++) {
+					size_t rawSize = std::min<size_t>(CompressedChunkSize, data.size() - c * CompressedChunkSize);
+					ok = decompressBlock(chunks[c].data(), chunks[c].size(), decompressed.data() + c * CompressedChunkSize, rawSize) && ok;
+				}
+			});
+			ok = ok && decompressed == data;
+
+			std::cout << "dat." << name << " level " << level << std::fixed << std::setprecision(1) << std::setw(8) << 100.0 * compressedBytes / data.size() << " %"
+				<< std::setw(10) << (data.size() / compressSeconds) / (1024.0 * 1024.0) << " MB/s compress" << std::setw(10)
+				<< (data.size() / decompressSeconds) / (1024.0 * 1024.0) << " MB/s decompress" << (ok ? "" : "  (Error: round trip mismatch)") << std::endl;
+		}
+	}
+}
+
+void DisplayBenchUsage() {
+	std::cerr << "MeshMasherBench.exe <benchmark> [args]\n";
+	std::cerr << "kernels = per kernel throughput of the vertex/index ingest kernels on the sample models\n";
+	std::cerr << "import = assimp import time on the sample models with the full quality preset vs the lean -mo 1 preset\n";
+	std::cerr << "schedule = worker idle time on the sample models with tasks in scene order vs largest estimated cost first\n";
+	std::cerr << "scaling [numTriangles] = mesh processing time of one synthetic mesh (default 10M triangles) for 1..N workers, whole vs chunked\n";
+	std::cerr << "write [megabytes] = time to write a synthetic buffer (default 1024 MB) with one ofstream vs parallel sync / io_uring / io_uring + O_DIRECT writes\n";
+	std::cerr << "compress = ratio and single thread compress / decompress MB/s of every -lz level on output/dat.vbf, dat.ebf and dat.rgb of a -lz 0 run\n";
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		DisplayBenchUsage();
+		return 1;
+	}
+
+	if (strcmp(argv[1], "kernels") == 0)
+		benchKernels();
+	else if (strcmp(argv[1], "import") == 0)
+		benchImport();
+	else if (strcmp(argv[1], "schedule") == 0)
+		benchSchedule();
+	else if (strcmp(argv[1], "scaling") == 0)
+		benchScaling(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 10000000);
+	else if (strcmp(argv[1], "write") == 0)
+		benchWrite(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1024);
+	else if (strcmp(argv[1], "compress") == 0)
+		benchCompress();
+	else {
+		DisplayBenchUsage();
+		return 1;
+	}
+	return 0;
+}
@@ -2,8 +2,11 @@
 #include <queue>
 #include <condition_variable>
 #include <mutex>
+#include <fstream>
 #include <iostream>
+#include <string>
 
+#include "FileIO.h"
 #include "Model.h"
 
 struct Model;
@@ -45,6 +48,19 @@ private:
 	Mesh& mesh;
 };
 
+class CMesh : public Command {
+public:
+	CMesh(MeshMasher* meshMasher, void(MeshMasher::* action)(Mesh& mesh), Mesh& mesh) :
+		meshMasher(meshMasher), action(action), mesh(mesh) {}
+
+	void execute() override { (meshMasher->*action)(mesh); }
+
+private:
+	MeshMasher* meshMasher;
+	void (MeshMasher::* action)(Mesh& mesh);
+	Mesh& mesh;
+};
+
 class CVoid : public Command {
 public:
 	CVoid(MeshMasher* meshMasher, void(MeshMasher::* action)()) :
@@ -57,6 +73,56 @@ private:
 	void (MeshMasher::* action)();
 };
 
+// opens one output file and hands the stream to a writer
+class CWriter : public Command {
+public:
+	CWriter(MeshMasher* meshMasher, void(MeshMasher::* action)(std::ostream&), std::string path) :
+		meshMasher(meshMasher), action(action), path(std::move(path)) {}
+
+	void execute() override {
+		std::ofstream ofile(path, std::fstream::out | std::fstream::binary);
+		if (ofile.is_open()) {
+			(meshMasher->*action)(ofile);
+			ofile.flush();
+		}
+		else
+			std::cout << "Error: " << path << " failed on creation." << std::endl;
+	}
+
+private:
+	MeshMasher* meshMasher;
+	void (MeshMasher::* action)(std::ostream&);
+	std::string path;
+};
+
+class CFileRange : public Command {
+public:
+	CFileRange(MeshMasher* meshMasher, void(MeshMasher::* action)(OutputFile&, const FileRange&), OutputFile& file, FileRange range) :
+		meshMasher(meshMasher), action(action), file(file), range(range) {}
+
+	void execute() override { (meshMasher->*action)(file, range); }
+
+private:
+	MeshMasher* meshMasher;
+	void (MeshMasher::* action)(OutputFile&, const FileRange&);
+	OutputFile& file;
+	FileRange range;
+};
+
+class CCompressChunk : public Command {
+public:
+	CCompressChunk(MeshMasher* meshMasher, void(MeshMasher::* action)(CompressedFile&, size_t), CompressedFile& file, size_t chunk) :
+		meshMasher(meshMasher), action(action), file(file), chunk(chunk) {}
+
+	void execute() override { (meshMasher->*action)(file, chunk); }
+
+private:
+	MeshMasher* meshMasher;
+	void (MeshMasher::* action)(CompressedFile&, size_t);
+	CompressedFile& file;
+	size_t chunk;
+};
+
 class CQueue {
 public:
 	void push(Command* com);
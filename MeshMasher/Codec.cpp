@@ -0,0 +1,226 @@
+#include "Codec.h"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace {
+	const size_t MinMatch = 4;
+	const size_t LastLiterals = 5;															// the last bytes of a block are never part of a match
+	const size_t MatchFindLimit = 12;														// no match starts in the last bytes of a block
+	const size_t MaxOffset = 65535;
+	const unsigned int MaxHashBits = 16;
+	const size_t WildCopy = 16;
+
+	uint32_t read32(const uint8_t* p) {
+		uint32_t value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	uint32_t hash4(const uint8_t* p, unsigned int hashBits) {
+		return (read32(p) * 2654435761u) >> (32 - hashBits);
+	}
+
+	// bytes equal from a and b on, a stops at limit. 8 bytes at a time, the first difference is the lowest set bit (little endian)
+	size_t countMatch(const uint8_t* a, const uint8_t* b, const uint8_t* limit) {
+		const uint8_t* start = a;
+		while (a + sizeof(uint64_t) <= limit) {
+			uint64_t x, y;
+			memcpy(&x, a, sizeof(x));
+			memcpy(&y, b, sizeof(y));
+			if (x != y)
+				return a - start + std::countr_zero(x ^ y) / 8;
+			a += sizeof(uint64_t);
+			b += sizeof(uint64_t);
+		}
+		while (a < limit && *a == *b) {
+			a++;
+			b++;
+		}
+		return a - start;
+	}
+
+	// the extra bytes of a length whose token nibble is 15
+	uint8_t* writeLength(uint8_t* op, size_t length) {
+		for (; length >= 255; length -= 255)
+			*op++ = 255;
+		*op++ = static_cast<uint8_t>(length);
+		return op;
+	}
+}
+
+size_t getCompressBound(size_t size) {
+	return size + size / 255 + 16;
+}
+
+size_t compressBlock(const void* src, size_t srcSize, void* dst, size_t dstCapacity, int level) {
+	level = std::clamp(level, MinCompressionLevel, MaxCompressionLevel);
+	const uint8_t* base = static_cast<const uint8_t*>(src);
+	const uint8_t* end = base + srcSize;
+	const uint8_t* matchLimit = srcSize > LastLiterals ? end - LastLiterals : base;
+	const uint8_t* ip = base;
+	const uint8_t* anchor = base;
+	uint8_t* op = static_cast<uint8_t*>(dst);
+	uint8_t* opEnd = op + dstCapacity;
+
+	// newest position per hash, and per position the distance back to the previous one with the same hash. the chain is a
+	// window of MaxOffset positions, anything older can not be referenced anyway. small blocks get a smaller table
+	unsigned int hashBits = 10;
+	while (hashBits < MaxHashBits && (size_t(1) << hashBits) < srcSize)
+		hashBits++;
+	std::vector<uint32_t> head(size_t(1) << hashBits, ~0u);
+	std::vector<uint16_t> chain(level > 1 ? std::min(srcSize, MaxOffset + 1) : 0);
+	const unsigned int maxAttempts = 1u << (level - 1);
+
+	auto insert = [&](const uint8_t* p) {
+		uint32_t pos = static_cast<uint32_t>(p - base), h = hash4(p, hashBits);
+		if (!chain.empty()) {
+			uint32_t distance = head[h] == ~0u ? 0 : pos - head[h];
+			chain[pos % chain.size()] = static_cast<uint16_t>(distance > MaxOffset ? 0 : distance);
+		}
+		head[h] = pos;
+	};
+	auto findMatch = [&](const uint8_t* p, const uint8_t*& match) {
+		size_t best = 0;
+		uint32_t pos = static_cast<uint32_t>(p - base), candidate = head[hash4(p, hashBits)];
+		for (unsigned int attempt = 0; attempt < maxAttempts && candidate != ~0u && pos - candidate <= MaxOffset; attempt++) {
+			const uint8_t* c = base + candidate;
+			if (read32(c) == read32(p)) {
+				size_t length = MinMatch + countMatch(p + MinMatch, c + MinMatch, matchLimit);
+				if (length > best) {
+					best = length;
+					match = c;
+					if (p + best == matchLimit)
+						break;																	// nothing can be longer
+				}
+			}
+			if (chain.empty() || chain[candidate % chain.size()] == 0)
+				break;
+			candidate -= chain[candidate % chain.size()];
+		}
+		return best;
+	};
+	auto emit = [&](size_t matchLength, size_t offset) {
+		size_t literalLength = ip - anchor;
+		if (static_cast<size_t>(opEnd - op) < 1 + literalLength / 255 + 1 + literalLength + 2 + matchLength / 255 + 1)
+			return false;
+		uint8_t* token = op++;
+		*token = static_cast<uint8_t>(std::min<size_t>(literalLength, 15) << 4);
+		if (literalLength >= 15)
+			op = writeLength(op, literalLength - 15);
+		if (literalLength != 0)
+			memcpy(op, anchor, literalLength);
+		op += literalLength;
+		if (matchLength == 0)
+			return true;																	// last literals, no match follows
+
+		*op++ = static_cast<uint8_t>(offset);
+		*op++ = static_cast<uint8_t>(offset >> 8);
+		*token |= static_cast<uint8_t>(std::min<size_t>(matchLength - MinMatch, 15));
+		if (matchLength - MinMatch >= 15)
+			op = writeLength(op, matchLength - MinMatch - 15);
+		return true;
+	};
+
+	while (ip + MatchFindLimit <= end) {
+		const uint8_t* match = nullptr;
+		size_t length = findMatch(ip, match);
+		insert(ip);
+		if (length < MinMatch) {
+			ip += level == 1 ? 1 + ((ip - anchor) >> 6) : 1;								// level 1 speeds up the longer nothing matches
+			continue;
+		}
+
+		// lazy matching, a literal is worth it when the next position starts a longer match
+		if (level >= 5) {
+			const uint8_t* next = nullptr;
+			size_t nextLength = 0;
+			while (ip + 1 + MatchFindLimit <= end && (nextLength = findMatch(ip + 1, next)) > length) {
+				insert(++ip);
+				match = next;
+				length = nextLength;
+			}
+		}
+
+		if (!emit(length, ip - match))
+			return 0;
+		const uint8_t* matchEnd = ip + length;
+		if (level > 1) {
+			for (const uint8_t* p = ip + 1; p < matchEnd && p + MatchFindLimit <= end; p++)
+				insert(p);
+		}
+		else if (matchEnd - 2 + MatchFindLimit <= end)
+			insert(matchEnd - 2);
+		ip = anchor = matchEnd;
+	}
+
+	ip = end;
+	if (!emit(0, 0))
+		return 0;
+	return op - static_cast<uint8_t*>(dst);
+}
+
+bool decompressBlock(const void* src, size_t srcSize, void* dst, size_t dstSize) {
+	const uint8_t* ip = static_cast<const uint8_t*>(src);
+	const uint8_t* ipEnd = ip + srcSize;
+	uint8_t* base = static_cast<uint8_t*>(dst);
+	uint8_t* op = base;
+	uint8_t* opEnd = op + dstSize;
+
+	auto readLength = [&](size_t& length) {
+		uint8_t byte = 255;
+		while (byte == 255) {
+			if (ip == ipEnd)
+				return false;
+			byte = *ip++;
+			length += byte;
+		}
+		return true;
+	};
+
+	while (ip < ipEnd) {
+		uint8_t token = *ip++;
+		size_t literalLength = token >> 4;
+		if (literalLength == 15 && !readLength(literalLength))
+			return false;
+		if (literalLength > static_cast<size_t>(ipEnd - ip) || literalLength > static_cast<size_t>(opEnd - op))
+			return false;
+		if (literalLength <= WildCopy && static_cast<size_t>(ipEnd - ip) >= WildCopy && static_cast<size_t>(opEnd - op) >= WildCopy)
+			memcpy(op, ip, WildCopy);															// short runs as one fixed size copy, the extra bytes are overwritten later
+		else if (literalLength != 0)
+			memcpy(op, ip, literalLength);
+		ip += literalLength;
+		op += literalLength;
+		if (ip == ipEnd)
+			break;																			// the last sequence has no match
+
+		if (ipEnd - ip < 2)
+			return false;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		size_t matchLength = token & 15;
+		if (matchLength == 15 && !readLength(matchLength))
+			return false;
+		matchLength += MinMatch;
+		if (offset == 0 || offset > static_cast<size_t>(op - base) || matchLength > static_cast<size_t>(opEnd - op))
+			return false;
+
+		// overlapping matches repeat the last offset bytes, so they are copied forward one byte at a time. matches far enough
+		// back go in 8 byte steps that may write up to 7 bytes past the match as long as they stay inside dst
+		const uint8_t* match = op - offset;
+		if (offset >= sizeof(uint64_t) && static_cast<size_t>(opEnd - op) >= matchLength + sizeof(uint64_t)) {
+			for (size_t i = 0; i < matchLength; i += sizeof(uint64_t))
+				memcpy(op + i, match + i, sizeof(uint64_t));
+		}
+		else if (offset >= matchLength)
+			memcpy(op, match, matchLength);
+		else {
+			for (size_t i = 0; i < matchLength; i++)
+				op[i] = match[i];
+		}
+		op += matchLength;
+	}
+	return op == opEnd;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <cstddef>
+
+// lz77 block codec writing the lz4 block format : token, literals, 16 bit offset, match length, matches of at least 4 bytes,
+// the last 5 bytes always literals. blocks are independent and at most 4 GB, the -lz output cuts every file into such blocks
+// level 1 probes a single hash slot like lz4 and skips faster over incompressible data, higher levels walk a hash chain of
+// 1 << (level - 1) candidates (lazy matching from level 5) and trade compression speed for ratio. decompression speed is the same
+const int MinCompressionLevel = 1;
+const int MaxCompressionLevel = 9;
+
+size_t getCompressBound(size_t size);													// worst case compressed size of size bytes
+size_t compressBlock(const void* src, size_t srcSize, void* dst, size_t dstCapacity, int level);		// compressed size, 0 when it does not fit
+bool decompressBlock(const void* src, size_t srcSize, void* dst, size_t dstSize);		// false unless src decodes to exactly dstSize bytes
@@ -0,0 +1,530 @@
+#include "FileIO.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define MESHMASHER_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+#endif
+
+const char* getWriteBackendName(WriteBackend backend) {
+	return backend == WriteBackend::Uring ? "uring" : "sync";
+}
+
+bool parseWriteBackend(const char* name, WriteBackend& backend) {
+	for (auto b : { WriteBackend::Sync, WriteBackend::Uring }) {
+		if (strcmp(name, getWriteBackendName(b)) == 0) {
+			backend = b;
+			return true;
+		}
+	}
+	return false;
+}
+
+#ifdef MESHMASHER_IO_URING
+// One io_uring per output file, set up with the raw syscalls so liburing is not needed. Workers only hand their ranges to the ring thread
+// and move on to their next task, the ring thread batches everything handed over since its last io_uring_enter into one submission
+// Requests belong to the task that submitted them and are cancelled when it exits, one long lived submitter keeps them alive
+// With a direct fd the page aligned middle of every range is copied into registered buffers and written with O_DIRECT, the unaligned
+// head and tail go through the buffered fd
+class UringWriter {
+public:
+	UringWriter(int fd, int directFd) : fd(fd), directFd(directFd) {}
+	~UringWriter();
+	UringWriter(const UringWriter&) = delete;
+	UringWriter& operator=(const UringWriter&) = delete;
+
+	bool init();
+	bool write(uint64_t offset, const char* data, size_t size);
+	bool drain();
+	bool isDirect() const { return directFd >= 0; }
+
+private:
+	static constexpr unsigned int numSlots = 64;											// sqes in flight, the cq has twice as many entries so it never overflows
+	static constexpr unsigned int numBuffers = 16;
+	static constexpr size_t bufferSize = 1 << 20;
+	static constexpr size_t directAlignment = 4096;
+	static constexpr unsigned int maxRetries = 10000;										// of io_uring_enter on EAGAIN / EBUSY, 100 us apart
+
+	struct Request {
+		uint64_t offset;
+		const char* data;
+		size_t size;
+		int buffer;																		// staging buffer, -1 for writes straight from the callers memory
+	};
+
+	int fd, directFd;
+	int ringFd = -1;
+	io_uring_params params = {};
+	void* sqRing = nullptr;
+	void* cqRing = nullptr;
+	size_t sqRingSize = 0, cqRingSize = 0;
+	io_uring_sqe* sqes = nullptr;
+	unsigned int* sqTail = nullptr, * sqMask = nullptr, * sqArray = nullptr;
+	unsigned int* cqHead = nullptr, * cqTail = nullptr, * cqMask = nullptr;
+	io_uring_cqe* cqes = nullptr;
+	char* staging = nullptr;
+	bool fixedBuffers = false;
+
+	// ring state, only touched by the ring thread
+	std::vector<Request> requests;
+	std::vector<unsigned int> freeSlots;
+	unsigned int pending = 0;															// queued in the sq, not yet submitted
+	bool broken = false;																// io_uring_enter failed, only completions are polled for
+
+	// shared with the workers, guarded by mut
+	std::mutex mut;
+	std::condition_variable cv;
+	std::deque<Request> waiting;
+	std::vector<unsigned int> freeBuffers;
+	unsigned int inFlight = 0;
+	bool failed = false, stop = false;
+	std::thread ringThread;
+
+	void runRing();
+	void queue(const Request& request);
+	void unqueue();
+	void reap();
+	void dropWaiting();
+	bool writeSync(uint64_t offset, const char* data, size_t size);
+};
+
+UringWriter::~UringWriter() {
+	if (ringThread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mut);
+			stop = true;
+		}
+		cv.notify_all();
+		ringThread.join();
+	}
+	if (sqes != nullptr)
+		munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+	if (cqRing != nullptr && cqRing != sqRing)
+		munmap(cqRing, cqRingSize);
+	if (sqRing != nullptr)
+		munmap(sqRing, sqRingSize);
+	if (ringFd >= 0)
+		::close(ringFd);
+	if (directFd >= 0)
+		::close(directFd);
+	if (staging != nullptr)
+		::operator delete(staging, std::align_val_t(directAlignment));
+}
+
+bool UringWriter::init() {
+	ringFd = static_cast<int>(syscall(__NR_io_uring_setup, numSlots, &params));
+	if (ringFd < 0)
+		return false;
+
+	sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+	sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+	if (sqRing == MAP_FAILED) {
+		sqRing = nullptr;
+		return false;
+	}
+	cqRing = sqRing;
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+		cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+		if (cqRing == MAP_FAILED) {
+			cqRing = nullptr;
+			return false;
+		}
+	}
+	void* sqeMap = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+	if (sqeMap == MAP_FAILED)
+		return false;
+	sqes = static_cast<io_uring_sqe*>(sqeMap);
+
+	char* sq = static_cast<char*>(sqRing);
+	char* cq = static_cast<char*>(cqRing);
+	sqTail = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+	sqMask = reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+	sqArray = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+	cqHead = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+	cqTail = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+	cqMask = reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+	cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+	requests.resize(numSlots);
+	for (unsigned int s = numSlots; s-- > 0;)
+		freeSlots.push_back(s);
+
+	if (directFd >= 0) {
+		// registered buffers skip pinning the pages on every write, plain writes from the same buffers when the memlock limit is too low
+		staging = static_cast<char*>(::operator new(numBuffers * bufferSize, std::align_val_t(directAlignment)));
+		std::vector<iovec> iovecs(numBuffers);
+		for (unsigned int b = 0; b < numBuffers; b++) {
+			iovecs[b] = { staging + b * bufferSize, bufferSize };
+			freeBuffers.push_back(numBuffers - 1 - b);
+		}
+		fixedBuffers = syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, iovecs.data(), numBuffers) == 0;
+	}
+
+	ringThread = std::thread(&UringWriter::runRing, this);
+	return true;
+}
+
+void UringWriter::runRing() {
+	std::unique_lock<std::mutex> lock(mut);
+	for (;;) {
+		cv.wait(lock, [&]() { return stop || !waiting.empty() || inFlight != 0; });
+		if (waiting.empty() && inFlight == 0)
+			return;
+
+		if (broken) {
+			// completions of the writes the kernel already owns still land in the cq, poll for them until none is left
+			lock.unlock();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			lock.lock();
+			reap();
+			dropWaiting();
+			cv.notify_all();
+			continue;
+		}
+
+		// everything handed over since the last submission goes out in one io_uring_enter
+		while (!waiting.empty() && !freeSlots.empty()) {
+			queue(waiting.front());
+			waiting.pop_front();
+		}
+		unsigned int minComplete = inFlight != 0 ? 1 : 0;
+		lock.unlock();
+
+		bool ok = true;
+		unsigned int flags = IORING_ENTER_GETEVENTS;
+		unsigned int retries = 0;
+		while (pending != 0 || minComplete != 0) {
+			long submitted = syscall(__NR_io_uring_enter, ringFd, pending, minComplete, flags, nullptr, 0);
+			if (submitted < 0 && errno == EINTR)
+				continue;
+			if (submitted < 0 && (errno == EAGAIN || errno == EBUSY) && ++retries < maxRetries) {
+				// out of kernel resources or the cq is full, make room and try again
+				lock.lock();
+				reap();
+				minComplete = inFlight != 0 ? minComplete : 0;
+				cv.notify_all();
+				lock.unlock();
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+				continue;
+			}
+			if (submitted < 0) {
+				ok = false;
+				break;
+			}
+			pending -= static_cast<unsigned int>(submitted);
+			minComplete = 0;
+			flags = 0;
+		}
+
+		lock.lock();
+		if (!ok) {
+			// the ring is unusable. sqes the kernel never took are taken back, the ones it owns are waited for before
+			// drain() returns so nobody frees the memory they write from
+			failed = true;
+			broken = true;
+			unqueue();
+		}
+		reap();
+		if (failed)
+			dropWaiting();
+		cv.notify_all();
+	}
+}
+
+void UringWriter::unqueue() {
+	// a failed io_uring_enter consumed none of the pending sqes, they are the newest ones in the sq
+	unsigned int tail = *sqTail;
+	for (; pending != 0; pending--) {
+		tail--;
+		unsigned int slot = static_cast<unsigned int>(sqes[sqArray[tail & *sqMask]].user_data);
+		if (requests[slot].buffer >= 0)
+			freeBuffers.push_back(static_cast<unsigned int>(requests[slot].buffer));
+		freeSlots.push_back(slot);
+		inFlight--;
+	}
+	std::atomic_ref<unsigned int>(*sqTail).store(tail, std::memory_order_release);
+}
+
+void UringWriter::dropWaiting() {
+	// the file has failed anyway, nothing handed over is written any more
+	for (const Request& request : waiting) {
+		if (request.buffer >= 0)
+			freeBuffers.push_back(static_cast<unsigned int>(request.buffer));
+	}
+	waiting.clear();
+}
+
+void UringWriter::queue(const Request& request) {
+	// a slot has at most one sqe queued and there are as many slots as sq entries, so the sq never overflows
+	unsigned int slot = freeSlots.back();
+	freeSlots.pop_back();
+	requests[slot] = request;
+	inFlight++;
+
+	unsigned int tail = *sqTail;
+	unsigned int index = tail & *sqMask;
+	io_uring_sqe& sqe = sqes[index];
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = request.buffer >= 0 && fixedBuffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+	sqe.fd = request.buffer >= 0 ? directFd : fd;
+	sqe.addr = reinterpret_cast<uint64_t>(request.data);
+	sqe.len = static_cast<uint32_t>(request.size);
+	sqe.off = request.offset;
+	sqe.buf_index = request.buffer >= 0 ? static_cast<uint16_t>(request.buffer) : 0;
+	sqe.user_data = slot;
+	sqArray[index] = index;
+	std::atomic_ref<unsigned int>(*sqTail).store(tail + 1, std::memory_order_release);
+	pending++;
+}
+
+void UringWriter::reap() {
+	unsigned int head = *cqHead;
+	unsigned int tail = std::atomic_ref<unsigned int>(*cqTail).load(std::memory_order_acquire);
+	for (; head != tail; head++) {
+		const io_uring_cqe& cqe = cqes[head & *cqMask];
+		unsigned int slot = static_cast<unsigned int>(cqe.user_data);
+		Request& request = requests[slot];
+
+		// short writes are finished synchronously, the remainder may no longer be aligned for O_DIRECT
+		if (cqe.res < 0)
+			failed = true;
+		else if (static_cast<size_t>(cqe.res) < request.size && !writeSync(request.offset + cqe.res, request.data + cqe.res, request.size - cqe.res))
+			failed = true;
+
+		if (request.buffer >= 0)
+			freeBuffers.push_back(static_cast<unsigned int>(request.buffer));
+		freeSlots.push_back(slot);
+		inFlight--;
+	}
+	std::atomic_ref<unsigned int>(*cqHead).store(head, std::memory_order_release);
+}
+
+bool UringWriter::writeSync(uint64_t offset, const char* data, size_t size) {
+	while (size != 0) {
+		ssize_t written = pwrite(fd, data, size, static_cast<off_t>(offset));
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return false;
+		data += written;
+		offset += written;
+		size -= written;
+	}
+	return true;
+}
+
+bool UringWriter::write(uint64_t offset, const char* data, size_t size) {
+	if (directFd < 0) {
+		{
+			std::lock_guard<std::mutex> lock(mut);
+			if (failed)
+				return false;
+			for (size_t done = 0; done < size; done += bufferSize * 4)
+				waiting.push_back({ offset + done, data + done, std::min(bufferSize * 4, size - done), -1 });
+		}
+		cv.notify_all();
+		return true;
+	}
+
+	// page aligned middle through O_DIRECT, the head and tail share pages with the neighbouring ranges
+	uint64_t begin = std::min((offset + directAlignment - 1) & ~uint64_t(directAlignment - 1), offset + size);
+	uint64_t end = std::max((offset + size) & ~uint64_t(directAlignment - 1), begin);
+	bool ok = writeSync(offset, data, begin - offset) && writeSync(end, data + (end - offset), offset + size - end);
+	for (uint64_t chunk = begin; chunk < end; chunk += bufferSize) {
+		size_t len = static_cast<size_t>(std::min<uint64_t>(bufferSize, end - chunk));
+		unsigned int buffer = 0;
+		{
+			std::unique_lock<std::mutex> lock(mut);
+			cv.wait(lock, [&]() { return failed || !freeBuffers.empty(); });
+			if (failed)
+				return false;
+			buffer = freeBuffers.back();
+			freeBuffers.pop_back();
+		}
+
+		// copy outside the lock so workers fill their buffers concurrently
+		char* staged = staging + buffer * bufferSize;
+		memcpy(staged, data + (chunk - offset), len);
+		{
+			std::lock_guard<std::mutex> lock(mut);
+			if (failed) {
+				freeBuffers.push_back(buffer);
+				return false;
+			}
+			waiting.push_back({ chunk, staged, len, static_cast<int>(buffer) });
+		}
+		cv.notify_all();
+	}
+	return ok;
+}
+
+bool UringWriter::drain() {
+	std::unique_lock<std::mutex> lock(mut);
+	cv.wait(lock, [&]() { return (waiting.empty() || failed) && inFlight == 0; });
+	return !failed;
+}
+#else
+// io_uring needs linux, OutputFile never creates one elsewhere
+class UringWriter {
+public:
+	bool write(uint64_t, const char*, size_t) { return false; }
+	bool drain() { return false; }
+	bool isDirect() const { return false; }
+};
+#endif
+
+#ifdef _WIN32
+OutputFile::OutputFile() : handle(INVALID_HANDLE_VALUE), backend(WriteBackend::Sync), failed(false) {}
+
+bool OutputFile::open(const std::string& filePath, uint64_t size, WriteBackend, bool) {
+	close();
+	path = filePath;
+	failed = false;
+	backend = WriteBackend::Sync;
+	handle = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	// reserve the whole file so concurrent writes never extend it
+	FILE_END_OF_FILE_INFO endOfFile;
+	endOfFile.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+	if (!SetFileInformationByHandle(handle, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile))) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool OutputFile::write(uint64_t offset, const void* data, size_t size) {
+	const char* bytes = static_cast<const char*>(data);
+	while (size != 0) {
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = static_cast<DWORD>(offset);
+		overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+		DWORD written = 0;
+		if (!WriteFile(handle, bytes, static_cast<DWORD>(std::min<size_t>(size, 1u << 30)), &written, &overlapped) || written == 0) {
+			failed = true;
+			return false;
+		}
+		bytes += written;
+		offset += written;
+		size -= written;
+	}
+	return true;
+}
+
+bool OutputFile::close() {
+	if (handle != INVALID_HANDLE_VALUE) {
+		CloseHandle(handle);
+		handle = INVALID_HANDLE_VALUE;
+	}
+	return !failed;
+}
+#else
+OutputFile::OutputFile() : fd(-1), backend(WriteBackend::Sync), failed(false) {}
+
+bool OutputFile::open(const std::string& filePath, uint64_t size, WriteBackend requested, bool directIo) {
+	close();
+	path = filePath;
+	failed = false;
+	backend = WriteBackend::Sync;
+	fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+
+	// reserve the whole file so concurrent writes never extend it, ftruncate where fallocate is missing
+	int result = -1;
+#ifdef __linux__
+	if (size != 0)
+		result = posix_fallocate(fd, 0, static_cast<off_t>(size));
+#endif
+	if (result != 0 && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+		close();
+		return false;
+	}
+
+#ifdef MESHMASHER_IO_URING
+	if (requested == WriteBackend::Uring) {
+		// O_DIRECT is refused by some file systems (tmpfs), those keep buffered writes
+		int directFd = directIo ? ::open(path.c_str(), O_WRONLY | O_DIRECT) : -1;
+		uring = std::make_unique<UringWriter>(fd, directFd);
+		if (uring->init())
+			backend = WriteBackend::Uring;
+		else
+			uring.reset();
+	}
+#else
+	(void)requested;
+	(void)directIo;
+#endif
+	return true;
+}
+
+bool OutputFile::write(uint64_t offset, const void* data, size_t size) {
+	if (uring != nullptr) {
+		if (!uring->write(offset, static_cast<const char*>(data), size))
+			failed = true;
+		return !failed;
+	}
+
+	const char* bytes = static_cast<const char*>(data);
+	while (size != 0) {
+		ssize_t written = pwrite(fd, bytes, size, static_cast<off_t>(offset));
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0) {
+			failed = true;
+			return false;
+		}
+		bytes += written;
+		offset += written;
+		size -= written;
+	}
+	return true;
+}
+
+bool OutputFile::close() {
+	if (uring != nullptr) {
+		if (!uring->drain())
+			failed = true;
+		uring.reset();
+	}
+	if (fd >= 0) {
+		::close(fd);
+		fd = -1;
+	}
+	return !failed;
+}
+#endif
+
+bool OutputFile::isDirect() const {
+	return uring != nullptr && uring->isDirect();
+}
+
+OutputFile::~OutputFile() {
+	close();
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "OutputFormat.h"
+
+// how OutputFile issues its writes
+enum class WriteBackend {
+	Sync,																				// pwrite / WriteFile, the write returns once the data is in the page cache
+	Uring																				// linux io_uring, writes are queued and only waited for in close()
+};
+
+const char* getWriteBackendName(WriteBackend backend);
+bool parseWriteBackend(const char* name, WriteBackend& backend);
+
+// one byte range of an output file whose final offset is known before anything is written
+struct FileRange {
+	uint64_t offset;
+	const void* data;
+	size_t size;
+};
+
+// -lz, one output file cut into chunks compressed on their own. source holds the raw ranges in file order, the task of
+// chunk i fills chunks[i] and index[i], head (header, chunk index, padding) is built once every chunk is done
+struct CompressedFile {
+	std::vector<FileRange> source;
+	uint64_t rawSize;
+	int level;
+	std::vector<std::vector<char>> chunks;
+	std::vector<CompressedChunk> index;
+	std::vector<char> head;
+	uint64_t size;																		// of the whole compressed file
+	CompressedFile() : rawSize(0), level(0), size(0) {}
+};
+
+class UringWriter;
+
+// Output file of a size known up front, preallocated on open so every worker can write its ranges at their final offset concurrently
+// Writes are positional (pwrite / WriteFile with an OVERLAPPED offset / io_uring) and never share a file pointer, so they need no locking
+// With WriteBackend::Uring the written memory must stay valid until close() unless the file is opened with directIo, which copies
+// into registered page aligned buffers. When io_uring or O_DIRECT are not available the file falls back to Sync / buffered writes
+class OutputFile {
+public:
+	OutputFile();
+	~OutputFile();
+	OutputFile(const OutputFile&) = delete;
+	OutputFile& operator=(const OutputFile&) = delete;
+
+	bool open(const std::string& path, uint64_t size, WriteBackend backend = WriteBackend::Sync, bool directIo = false);
+	bool write(uint64_t offset, const void* data, size_t size);							// thread safe
+	bool close();																		// waits for queued writes, false when any write failed
+	const std::string& getPath() const { return path; }
+	WriteBackend getBackend() const { return backend; }									// the one actually used
+	bool isDirect() const;
+
+private:
+	std::string path;
+#ifdef _WIN32
+	void* handle;
+#else
+	int fd;
+#endif
+	WriteBackend backend;
+	std::unique_ptr<UringWriter> uring;
+	std::atomic<bool> failed;
+};
@@ -0,0 +1,280 @@
+#include "Kernels.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define MM_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// msvc emits any intrinsic without flags, gcc/clang need the instruction set enabled per function
+#if defined(MM_X86) && (defined(__GNUC__) || defined(__clang__))
+#define MM_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MM_TARGET(isa)
+#endif
+
+static KernelLevel detectKernelLevel() {
+#if defined(MM_X86)
+	bool sse41 = false, avx2 = false;
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	__cpuid(info, 1);
+	sse41 = (info[2] & (1 << 19)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+	// avx registers must also be saved by the os
+	if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	sse41 = __builtin_cpu_supports("sse4.1");
+	avx2 = __builtin_cpu_supports("avx2");
+#endif
+	if (avx2)
+		return KernelLevel::AVX2;
+	if (sse41)
+		return KernelLevel::SSE41;
+#endif
+	return KernelLevel::Scalar;
+}
+
+KernelLevel getKernelLevel() {
+	static const KernelLevel level = detectKernelLevel();
+	return level;
+}
+
+const char* getKernelLevelName(KernelLevel level) {
+	switch (level) {
+	case KernelLevel::AVX2: return "avx2";
+	case KernelLevel::SSE41: return "sse4.1";
+	default: return "scalar";
+	}
+}
+
+static inline void packVertexScalar(Vertex& dst, const aiVector3D* positions, const aiVector3D* texCoords, const aiVector3D* normals, size_t v) {
+	dst = Vertex(positions[v], aiVector2D(texCoords[v].x, texCoords[v].y), normals[v]);
+}
+
+static void interleaveVerticesScalar(Vertex* dst, const aiVector3D* positions, const aiVector3D* texCoords, const aiVector3D* normals, size_t begin, size_t end) {
+	for (size_t v = begin; v < end; v++)
+		packVertexScalar(dst[v], positions, texCoords, normals, v);
+}
+
+static void gatherVerticesScalar(Vertex* dst, const aiVector3D* positions, const aiVector3D* texCoords, const aiVector3D* normals, const unsigned int* sourceVertices, size_t count) {
+	for (size_t i = 0; i < count; i++)
+		packVertexScalar(dst[i], positions, texCoords, normals, sourceVertices[i]);
+}
+
+static void flattenFacesScalar(unsigned int* dst, const aiFace* faces, size_t begin, size_t end) {
+	for (size_t f = begin; f < end; f++) {
+		dst[f * 3 + 0] = faces[f].mIndices[0];
+		dst[f * 3 + 1] = faces[f].mIndices[1];
+		dst[f * 3 + 2] = faces[f].mIndices[2];
+	}
+}
+
+#if defined(MM_X86)
+// one vertex is exactly 8 floats [px py pz u | v nx ny nz], built from 3 unaligned loads of 4 floats each
+// a 4 float load of element v reads the first float of element v + 1, so the last vertex always goes scalar
+MM_TARGET("sse4.1") static inline void packVertex(const aiVector3D* positions, const aiVector3D* texCoords, const aiVector3D* normals, size_t v, __m128& lo, __m128& hi) {
+	__m128 p = _mm_loadu_ps(&positions[v].x);
+	__m128 t = _mm_loadu_ps(&texCoords[v].x);
+	__m128 n = _mm_loadu_ps(&normals[v].x);
+	lo = _mm_blend_ps(p, _mm_shuffle_ps(t, t, _MM_SHUFFLE(0, 0, 0, 0)), 0x8);
+	hi = _mm_blend_ps(_mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(n), 4)), _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 1, 1, 1)), 0x1);
+}
+
+MM_TARGET("sse4.1") static void interleaveVerticesSSE41(Vertex* dst, const aiVector3D* positions, const aiVector3D* texCoords, const aiVector3D* normals, size_t count) {
+	size_t v = 0;
+	for (; v + 1 < count; v++) {
+		__m128 lo, hi;
+		packVertex(positions, texCoords, normals, v, lo, hi);
+		_mm_storeu_ps(&dst[v].pos.x, lo);
+		_mm_storeu_ps(&dst[v].pos.x + 4, hi);
+	}
+	interleaveVerticesScalar(dst, positions, texCoords, normals, v, count);
+}
+
+MM_TARGET("avx2") static void interleaveVerticesAVX2(Vertex* dst, const aiVector3D* positions, const aiVector3D* texCoords, const aiVector3D* normals, size_t count) {
+	size_t v = 0;
+	for (; v + 1 < count; v++) {
+		__m128 lo, hi;
+		packVertex(positions, texCoords, normals, v, lo, hi);
+		_mm256_storeu_ps(&dst[v].pos.x, _mm256_set_m128(hi, lo));
+	}
+	interleaveVerticesScalar(dst, positions, texCoords, normals, v, count);
+}
+
+MM_TARGET("sse4.1") static void gatherVerticesSSE41(Vertex* dst, const aiVector3D* positions, const aiVector3D* texCoords, const aiVector3D* normals, size_t sourceCount, const unsigned int* sourceVertices, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		size_t v = sourceVertices[i];
+		if (v + 1 == sourceCount) {
+			packVertexScalar(dst[i], positions, texCoords, normals, v);
+			continue;
+		}
+		__m128 lo, hi;
+		packVertex(positions, texCoords, normals, v, lo, hi);
+		_mm_storeu_ps(&dst[i].pos.x, lo);
+		_mm_storeu_ps(&dst[i].pos.x + 4, hi);
+	}
+}
+
+MM_TARGET("avx2") static void gatherVerticesAVX2(Vertex* dst, const aiVector3D* positions, const aiVector3D* texCoords, const aiVector3D* normals, size_t sourceCount, const unsigned int* sourceVertices, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		size_t v = sourceVertices[i];
+		if (v + 1 == sourceCount) {
+			packVertexScalar(dst[i], positions, texCoords, normals, v);
+			continue;
+		}
+		__m128 lo, hi;
+		packVertex(positions, texCoords, normals, v, lo, hi);
+		_mm256_storeu_ps(&dst[i].pos.x, _mm256_set_m128(hi, lo));
+	}
+}
+
+// 4 faces per block, read in output order and written with 3 wide stores instead of 12 scalar ones
+MM_TARGET("sse4.1") static void flattenFacesSSE41(unsigned int* dst, const aiFace* faces, size_t count) {
+	size_t f = 0;
+	for (; f + 4 <= count; f += 4) {
+		const unsigned int* i0 = faces[f].mIndices;
+		const unsigned int* i1 = faces[f + 1].mIndices;
+		const unsigned int* i2 = faces[f + 2].mIndices;
+		const unsigned int* i3 = faces[f + 3].mIndices;
+		__m128i* out = reinterpret_cast<__m128i*>(dst + f * 3);
+		_mm_storeu_si128(out, _mm_setr_epi32(i0[0], i0[1], i0[2], i1[0]));
+		_mm_storeu_si128(out + 1, _mm_setr_epi32(i1[1], i1[2], i2[0], i2[1]));
+		_mm_storeu_si128(out + 2, _mm_setr_epi32(i2[2], i3[0], i3[1], i3[2]));
+	}
+	flattenFacesScalar(dst, faces, f, count);
+}
+
+// 4 faces per block, each of the 3 output vectors gathers 4 indices straight through the aiFace::mIndices pointers
+// gather lanes are [p0+0 p0+4 p0+8 p1+0] [p1+4 p1+8 p2+0 p2+4] [p2+8 p3+0 p3+4 p3+8] in bytes
+MM_TARGET("avx2") static void flattenFacesAVX2(unsigned int* dst, const aiFace* faces, size_t count) {
+	const __m256i offsets0 = _mm256_setr_epi64x(0, 4, 8, 0);
+	const __m256i offsets1 = _mm256_setr_epi64x(4, 8, 0, 4);
+	const __m256i offsets2 = _mm256_setr_epi64x(8, 0, 4, 8);
+	size_t f = 0;
+	for (; f + 4 <= count; f += 4) {
+		__m256i pointers = _mm256_setr_epi64x(
+			reinterpret_cast<long long>(faces[f].mIndices), reinterpret_cast<long long>(faces[f + 1].mIndices),
+			reinterpret_cast<long long>(faces[f + 2].mIndices), reinterpret_cast<long long>(faces[f + 3].mIndices));
+		__m256i address0 = _mm256_add_epi64(_mm256_permute4x64_epi64(pointers, _MM_SHUFFLE(1, 0, 0, 0)), offsets0);
+		__m256i address1 = _mm256_add_epi64(_mm256_permute4x64_epi64(pointers, _MM_SHUFFLE(2, 2, 1, 1)), offsets1);
+		__m256i address2 = _mm256_add_epi64(_mm256_permute4x64_epi64(pointers, _MM_SHUFFLE(3, 3, 3, 2)), offsets2);
+		__m128i* out = reinterpret_cast<__m128i*>(dst + f * 3);
+		_mm_storeu_si128(out, _mm256_i64gather_epi32(static_cast<const int*>(nullptr), address0, 1));
+		_mm_storeu_si128(out + 1, _mm256_i64gather_epi32(static_cast<const int*>(nullptr), address1, 1));
+		_mm_storeu_si128(out + 2, _mm256_i64gather_epi32(static_cast<const int*>(nullptr), address2, 1));
+	}
+	flattenFacesScalar(dst, faces, f, count);
+}
+#endif
+
+void interleaveVertices(Vertex* dst, const aiVector3D* positions, const aiVector3D* texCoords, const aiVector3D* normals, size_t count) {
+	interleaveVertices(getKernelLevel(), dst, positions, texCoords, normals, count);
+}
+
+void interleaveVertices(KernelLevel level, Vertex* dst, const aiVector3D* positions, const aiVector3D* texCoords, const aiVector3D* normals, size_t count) {
+#if defined(MM_X86)
+	if (level == KernelLevel::AVX2)
+		return interleaveVerticesAVX2(dst, positions, texCoords, normals, count);
+	if (level == KernelLevel::SSE41)
+		return interleaveVerticesSSE41(dst, positions, texCoords, normals, count);
+#endif
+	interleaveVerticesScalar(dst, positions, texCoords, normals, 0, count);
+}
+
+void gatherVertices(Vertex* dst, const aiVector3D* positions, const aiVector3D* texCoords, const aiVector3D* normals, size_t sourceCount, const unsigned int* sourceVertices, size_t count) {
+	gatherVertices(getKernelLevel(), dst, positions, texCoords, normals, sourceCount, sourceVertices, count);
+}
+
+void gatherVertices(KernelLevel level, Vertex* dst, const aiVector3D* positions, const aiVector3D* texCoords, const aiVector3D* normals, size_t sourceCount, const unsigned int* sourceVertices, size_t count) {
+#if defined(MM_X86)
+	if (level == KernelLevel::AVX2)
+		return gatherVerticesAVX2(dst, positions, texCoords, normals, sourceCount, sourceVertices, count);
+	if (level == KernelLevel::SSE41)
+		return gatherVerticesSSE41(dst, positions, texCoords, normals, sourceCount, sourceVertices, count);
+#endif
+	gatherVerticesScalar(dst, positions, texCoords, normals, sourceVertices, count);
+}
+
+void flattenFaces(unsigned int* dst, const aiFace* faces, size_t count) {
+	flattenFaces(getKernelLevel(), dst, faces, count);
+}
+
+void flattenFaces(KernelLevel level, unsigned int* dst, const aiFace* faces, size_t count) {
+#if defined(MM_X86)
+	if (level == KernelLevel::AVX2)
+		return flattenFacesAVX2(dst, faces, count);
+	if (level == KernelLevel::SSE41)
+		return flattenFacesSSE41(dst, faces, count);
+#endif
+	flattenFacesScalar(dst, faces, 0, count);
+}
+
+void computeBounds(const Vertex* vertices, size_t count, Bounds& bounds) {
+	if (count == 0)
+		return;
+
+	float fmin[4] = { vertices[0].pos.x, vertices[0].pos.y, vertices[0].pos.z, 0.f };
+	float fmax[4] = { fmin[0], fmin[1], fmin[2], 0.f };
+	size_t v = 1;
+#if defined(MM_X86)
+	// pos is the first member of Vertex so a 4 float load reads pos + texCoord.x which is ignored
+	__m128 vmin = _mm_loadu_ps(&vertices[0].pos.x);
+	__m128 vmax = vmin;
+	for (; v < count; v++) {
+		__m128 p = _mm_loadu_ps(&vertices[v].pos.x);
+		vmin = _mm_min_ps(vmin, p);
+		vmax = _mm_max_ps(vmax, p);
+	}
+	_mm_storeu_ps(fmin, vmin);
+	_mm_storeu_ps(fmax, vmax);
+#endif
+	for (; v < count; v++) {
+		for (unsigned int c = 0; c < 3; c++) {
+			fmin[c] = std::min(fmin[c], vertices[v].pos[c]);
+			fmax[c] = std::max(fmax[c], vertices[v].pos[c]);
+		}
+	}
+
+	bounds.min = aiVector3D(fmin[0], fmin[1], fmin[2]);
+	bounds.max = aiVector3D(fmax[0], fmax[1], fmax[2]);
+	bounds.center = aiVector3D((fmin[0] + fmax[0]) * 0.5f, (fmin[1] + fmax[1]) * 0.5f, (fmin[2] + fmax[2]) * 0.5f);
+
+	float radius2 = 0.f;
+	v = 0;
+#if defined(MM_X86)
+	// radius = max distance from center, 4 vertices at a time transposed into x/y/z lanes
+	__m128 cx = _mm_set1_ps(bounds.center.x), cy = _mm_set1_ps(bounds.center.y), cz = _mm_set1_ps(bounds.center.z);
+	__m128 maxDist2 = _mm_setzero_ps();
+	for (; v + 4 <= count; v += 4) {
+		__m128 dx = _mm_loadu_ps(&vertices[v].pos.x);
+		__m128 dy = _mm_loadu_ps(&vertices[v + 1].pos.x);
+		__m128 dz = _mm_loadu_ps(&vertices[v + 2].pos.x);
+		__m128 dw = _mm_loadu_ps(&vertices[v + 3].pos.x);
+		_MM_TRANSPOSE4_PS(dx, dy, dz, dw);
+		dx = _mm_sub_ps(dx, cx);
+		dy = _mm_sub_ps(dy, cy);
+		dz = _mm_sub_ps(dz, cz);
+		maxDist2 = _mm_max_ps(maxDist2, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+	}
+
+	float dist2[4];
+	_mm_storeu_ps(dist2, maxDist2);
+	radius2 = std::max(std::max(dist2[0], dist2[1]), std::max(dist2[2], dist2[3]));
+#endif
+	for (; v < count; v++) {
+		aiVector3D d = vertices[v].pos - bounds.center;
+		radius2 = std::max(radius2, d.x * d.x + d.y * d.y + d.z * d.z);
+	}
+	bounds.radius = std::sqrt(radius2);
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "Model.h"
+
+// instruction set picked once at runtime for the ingest kernels, every level falls back to the one below it
+enum class KernelLevel {
+	Scalar,
+	SSE41,
+	AVX2
+};
+
+KernelLevel getKernelLevel();															// detected on first call
+const char* getKernelLevelName(KernelLevel level);
+
+// pack the assimp v/t/n streams into interleaved Vertex, texCoords are aiVector3D and only x/y are kept
+void interleaveVertices(Vertex* dst, const aiVector3D* positions, const aiVector3D* texCoords, const aiVector3D* normals, size_t count);
+void interleaveVertices(KernelLevel level, Vertex* dst, const aiVector3D* positions, const aiVector3D* texCoords, const aiVector3D* normals, size_t count);
+
+// same packing through a gather list, dst[i] is built from source vertex sourceVertices[i] out of sourceCount source vertices
+void gatherVertices(Vertex* dst, const aiVector3D* positions, const aiVector3D* texCoords, const aiVector3D* normals, size_t sourceCount, const unsigned int* sourceVertices, size_t count);
+void gatherVertices(KernelLevel level, Vertex* dst, const aiVector3D* positions, const aiVector3D* texCoords, const aiVector3D* normals, size_t sourceCount, const unsigned int* sourceVertices, size_t count);
+
+// flatten triangle faces into a contiguous index array of 3 * count indices
+void flattenFaces(unsigned int* dst, const aiFace* faces, size_t count);
+void flattenFaces(KernelLevel level, unsigned int* dst, const aiFace* faces, size_t count);
+
+// aabb with a min/max reduction over the positions, then the bounding sphere around the aabb center
+void computeBounds(const Vertex* vertices, size_t count, Bounds& bounds);
@@ -0,0 +1,326 @@
+// LoadBench.cpp : MeshMasherLoadBench, loads MeshMasher output directories the way a renderer fills its buffers
+// usage: MeshMasherLoadBench.exe [directory ...], default output. Give one directory per layout to compare them,
+// e.g. the output of -ct 0, -ct 1 and -lz 1 copied next to each other
+//
+#include "Codec.h"
+#include "Reader.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// page aligned destination standing in for a persistently mapped gl buffer
+struct AlignedBuffer {
+	explicit AlignedBuffer(size_t size) : size(size), data(static_cast<std::byte*>(::operator new(size ? size : 1, std::align_val_t(4096)))) {
+		memset(data, 0, size);																// touch every page so the fills measure io, not page faults
+	}
+	~AlignedBuffer() { ::operator delete(data, std::align_val_t(4096)); }
+	AlignedBuffer(const AlignedBuffer&) = delete;
+	AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+	size_t size;
+	std::byte* data;
+};
+
+// read only handle for positional reads from every fill thread
+class InputFile {
+public:
+	std::string path;
+
+	InputFile(const InputFile&) = delete;
+	InputFile& operator=(const InputFile&) = delete;
+#ifdef _WIN32
+	explicit InputFile(const std::string& path) : path(path) {
+		handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	}
+	~InputFile() {
+		if (handle != INVALID_HANDLE_VALUE)
+			CloseHandle(handle);
+	}
+	bool isOpen() const { return handle != INVALID_HANDLE_VALUE; }
+
+	bool readAt(std::byte* dst, size_t size, uint64_t offset) const {
+		while (size > 0) {
+			OVERLAPPED overlapped = {};
+			overlapped.Offset = static_cast<DWORD>(offset);
+			overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+			DWORD read = 0;
+			if (!ReadFile(handle, dst, static_cast<DWORD>(std::min<size_t>(size, 1u << 30)), &read, &overlapped) || read == 0)
+				return false;
+			dst += read;
+			size -= read;
+			offset += read;
+		}
+		return true;
+	}
+
+	// no portable way to drop a file from the standby list without admin rights
+	bool dropCache() const { return false; }
+
+private:
+	void* handle;
+#else
+	explicit InputFile(const std::string& path) : path(path), fd(::open(path.c_str(), O_RDONLY)) {}
+	~InputFile() {
+		if (fd >= 0)
+			::close(fd);
+	}
+	bool isOpen() const { return fd >= 0; }
+
+	bool readAt(std::byte* dst, size_t size, uint64_t offset) const {
+		while (size > 0) {
+			ssize_t read = pread(fd, dst, size, static_cast<off_t>(offset));
+			if (read <= 0)
+				return false;
+			dst += read;
+			size -= static_cast<size_t>(read);
+			offset += static_cast<uint64_t>(read);
+		}
+		return true;
+	}
+
+	// dirty pages are not dropped, so flush the freshly written output first
+	bool dropCache() const {
+		fdatasync(fd);
+		return posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+	}
+
+private:
+	int fd;
+#endif
+};
+
+// one piece of a section, read by whichever fill thread takes it next. compressed chunks are decompressed into dst
+struct ReadChunk {
+	const InputFile* file;
+	uint64_t offset;																		// in the file
+	std::byte* dst;
+	size_t size;																			// bytes read
+	size_t rawSize;																			// bytes in dst, larger than size for compressed chunks
+	bool firstDraw;																			// needed before the first draw can be issued
+};
+
+// -lz sections and the file they decompress to
+const std::map<std::string, std::string> compressedRawNames = { { "vbz", "vbf" }, { "ebz", "ebf" }, { "rgz", "rgb" } };
+
+// chunk index of a -lz section, the raw file it decompresses to
+struct CompressedSection {
+	std::string rawName;
+	CompressedHeader header;
+	std::vector<CompressedChunk> chunks;
+};
+
+// one output directory, the sections a renderer uploads and the byte ranges its first draw needs
+struct Layout {
+	std::string directory;
+	std::string name;
+	std::vector<std::unique_ptr<InputFile>> files;
+	std::map<std::string, SectionLocation> sections;
+	std::map<std::string, CompressedSection> compressed;
+	std::map<std::string, std::pair<uint64_t, uint64_t>> firstDraw;						// raw section -> [begin, end) bytes
+	uint64_t totalBytes = 0;																// after decompression, what ends up in the buffers
+	uint64_t fileBytes = 0;
+};
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool openLayout(const std::string& directory, Layout& layout) {
+	OutputReader reader;
+	if (!reader.open(directory, std::max(1u, std::thread::hardware_concurrency()))) {
+		std::cout << "Error: " << reader.getError() << std::endl;
+		return false;
+	}
+	layout.directory = directory;
+	std::map<std::string, const InputFile*> filesByPath;
+	for (const char* name : { "ldr", "vbf", "ebf", "vbz", "ebz", "ins", "mtr", "txr", "rgb", "rgz", "sdr", "svb", "seb" }) {
+		SectionLocation location;
+		if (!reader.getSectionLocation(name, location))
+			continue;
+		uint64_t rawSize = location.size;
+		auto rawName = compressedRawNames.find(name);
+		if (rawName != compressedRawNames.end()) {
+			CompressedSection& section = layout.compressed[name];
+			std::span<const CompressedChunk> chunks;
+			if (!OutputReader::getCompressedChunks(reader.getSection(name), section.header, chunks)) {
+				std::cout << "Error: dat." << name << " is not a valid compressed file" << std::endl;
+				return false;
+			}
+			section.rawName = rawName->second;
+			section.chunks.assign(chunks.begin(), chunks.end());
+			rawSize = section.header.rawSize;
+		}
+		if (filesByPath.count(location.path) == 0) {
+			layout.files.push_back(std::make_unique<InputFile>(location.path));
+			if (!layout.files.back()->isOpen()) {
+				std::cout << "Error: " << location.path << " could not be opened" << std::endl;
+				return false;
+			}
+			filesByPath[location.path] = layout.files.back().get();
+		}
+		layout.sections[name] = location;
+		layout.totalBytes += rawSize;
+		layout.fileBytes += location.size;
+	}
+	layout.name = layout.sections["ldr"].path == directory + "/dat.mmc" ? "container" : "files";
+	if (!layout.compressed.empty())
+		layout.name += "+lz";
+
+	// the loader file, then the indices, vertices and transforms of draw 0
+	layout.firstDraw["ldr"] = { 0, layout.sections["ldr"].size };
+	auto commands = reader.getCommands();
+	if (!commands.empty()) {
+		const auto& command = commands[0];
+		auto drawIndices = reader.getIndices().subspan(command.firstIndex, command.count);
+		uint32_t minIndex = drawIndices.empty() ? 0 : *std::min_element(drawIndices.begin(), drawIndices.end());
+		uint32_t maxIndex = drawIndices.empty() ? 0 : *std::max_element(drawIndices.begin(), drawIndices.end());
+		layout.firstDraw["ebf"] = { command.firstIndex * sizeof(uint32_t), (command.firstIndex + command.count) * sizeof(uint32_t) };
+		layout.firstDraw["vbf"] = { (command.baseVertex + minIndex) * sizeof(PackedVertex), (command.baseVertex + maxIndex + 1) * sizeof(PackedVertex) };
+		if (layout.sections.count("ins") != 0)
+			layout.firstDraw["ins"] = { command.baseInstance * sizeof(InstanceTransform), (command.baseInstance + command.instanceCount) * sizeof(InstanceTransform) };
+	}
+
+	std::cout << layout.directory << " (" << layout.name << ") : " << reader.getCommands().size() << " draws, " << std::fixed << std::setprecision(1)
+		<< layout.totalBytes / (1024.0 * 1024.0) << " MB in " << layout.sections.size() << " sections, " << layout.fileBytes / (1024.0 * 1024.0)
+		<< " MB on disk" << std::endl;
+	return true;
+}
+
+// read every section into its own page aligned buffer with numThreads threads, the chunks draw 0 needs go first.
+// returns the seconds until everything is in, firstDrawSeconds is when the data of draw 0 was
+bool fillBuffers(const Layout& layout, unsigned int numThreads, size_t chunkSize, double& seconds, double& firstDrawSeconds) {
+	std::vector<std::unique_ptr<AlignedBuffer>> buffers;
+	std::vector<ReadChunk> chunks;
+	std::map<std::string, const InputFile*> filesByPath;
+	for (auto& file : layout.files)
+		filesByPath[file->path] = file.get();
+	for (auto& [name, location] : layout.sections) {
+		const InputFile* file = filesByPath.at(location.path);
+		auto compressed = layout.compressed.find(name);
+		if (compressed == layout.compressed.end()) {
+			buffers.push_back(std::make_unique<AlignedBuffer>(location.size));
+			auto range = layout.firstDraw.find(name);
+			for (uint64_t offset = 0; offset < location.size; offset += chunkSize) {
+				size_t size = static_cast<size_t>(std::min<uint64_t>(chunkSize, location.size - offset));
+				bool firstDraw = range != layout.firstDraw.end() && offset < range->second.second && offset + size > range->second.first;
+				chunks.push_back({ file, location.offset + offset, buffers.back()->data + offset, size, size, firstDraw });
+			}
+			continue;
+		}
+
+		// the header and chunk index come first, then every chunk decompresses into its place of the raw buffer
+		const CompressedSection& section = compressed->second;
+		uint64_t headSize = section.header.chunksOffset + sizeof(CompressedChunk) * section.chunks.size();
+		buffers.push_back(std::make_unique<AlignedBuffer>(static_cast<size_t>(headSize)));
+		chunks.push_back({ file, location.offset, buffers.back()->data, static_cast<size_t>(headSize), static_cast<size_t>(headSize), true });
+		buffers.push_back(std::make_unique<AlignedBuffer>(static_cast<size_t>(section.header.rawSize)));
+		auto range = layout.firstDraw.find(section.rawName);
+		for (size_t c = 0; c < section.chunks.size(); c++) {
+			uint64_t offset = uint64_t(c) * section.header.chunkSize;
+			size_t rawSize = static_cast<size_t>(std::min<uint64_t>(section.header.chunkSize, section.header.rawSize - offset));
+			bool firstDraw = range != layout.firstDraw.end() && offset < range->second.second && offset + rawSize > range->second.first;
+			chunks.push_back({ file, location.offset + section.chunks[c].offset, buffers.back()->data + offset, section.chunks[c].size,
+				(section.chunks[c].flags & CompressedStored) != 0 ? section.chunks[c].size : rawSize, firstDraw });
+		}
+	}
+	std::stable_partition(chunks.begin(), chunks.end(), [](const ReadChunk& chunk) { return chunk.firstDraw; });
+	size_t firstDrawChunks = std::count_if(chunks.begin(), chunks.end(), [](const ReadChunk& chunk) { return chunk.firstDraw; });
+
+	std::atomic<size_t> next(0), firstDrawLeft(firstDrawChunks);
+	std::atomic<bool> ok(true);
+	std::atomic<int64_t> firstDrawNs(0);
+	auto start = std::chrono::steady_clock::now();
+	auto readChunks = [&]() {
+		std::vector<std::byte> input;
+		for (size_t c = next++; c < chunks.size(); c = next++) {
+			const ReadChunk& chunk = chunks[c];
+			if (chunk.size == chunk.rawSize) {
+				if (!chunk.file->readAt(chunk.dst, chunk.size, chunk.offset))
+					ok = false;
+			}
+			else {
+				input.resize(chunk.size);
+				if (!chunk.file->readAt(input.data(), chunk.size, chunk.offset) || !decompressBlock(input.data(), chunk.size, chunk.dst, chunk.rawSize))
+					ok = false;
+			}
+			if (chunk.firstDraw && --firstDrawLeft == 0)
+				firstDrawNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		}
+	};
+	{
+		std::vector<std::jthread> threads;
+		for (unsigned int t = 1; t < numThreads; t++)
+			threads.emplace_back(readChunks);
+		readChunks();
+	}
+	seconds = secondsSince(start);
+	firstDrawSeconds = firstDrawChunks != 0 ? firstDrawNs * 1e-9 : 0.0;
+	return ok;
+}
+
+void benchLayout(const Layout& layout, unsigned int maxThreads, size_t chunkSize) {
+	bool canDropCache = true;
+	for (auto& file : layout.files)
+		canDropCache = canDropCache && file->dropCache();
+	if (!canDropCache)
+		std::cout << "Warning: the page cache can not be dropped here, cold runs are skipped" << std::endl;
+
+	for (bool cold : { true, false }) {
+		if (cold && !canDropCache)
+			continue;
+		for (unsigned int numThreads = 1; ; numThreads = std::min(numThreads * 2, maxThreads)) {
+			if (cold) {
+				for (auto& file : layout.files)
+					file->dropCache();
+			}
+			else {
+				double seconds = 0.0, firstDrawSeconds = 0.0;
+				fillBuffers(layout, numThreads, chunkSize, seconds, firstDrawSeconds);						// warm up the cache
+			}
+
+			double seconds = 0.0, firstDrawSeconds = 0.0;
+			if (!fillBuffers(layout, numThreads, chunkSize, seconds, firstDrawSeconds))
+				std::cout << "Error: " << layout.directory << " could not be read" << std::endl;
+			std::cout << std::left << std::setw(14) << layout.name << std::setw(6) << (cold ? "cold" : "warm") << std::right << std::setw(4) << numThreads
+				<< " threads" << std::fixed << std::setprecision(1) << std::setw(10) << (layout.totalBytes / seconds) / (1024.0 * 1024.0) << " MB/s"
+				<< std::setprecision(3) << std::setw(10) << seconds * 1000.0 << " ms total" << std::setw(10) << firstDrawSeconds * 1000.0 << " ms first draw"
+				<< std::endl;
+			if (numThreads == maxThreads)
+				break;
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	std::vector<std::string> directories(argv + 1, argv + argc);
+	if (directories.empty())
+		directories.push_back("output");
+
+	unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	const size_t chunkSize = 1 << 22;
+	for (auto& directory : directories) {
+		Layout layout;
+		if (!openLayout(directory, layout))
+			return 1;
+		benchLayout(layout, maxThreads, chunkSize);
+	}
+	return 0;
+}
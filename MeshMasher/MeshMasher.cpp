@@ -1,21 +1,73 @@
-﻿// MeshMasher.cpp : Defines the entry point for the application.
+﻿// MeshMasher.cpp : Mesh, material and texture processing on the worker pool and writing of the output files.
 //
 #include "MeshMasher.h"
+#include "Codec.h"
+#include "Kernels.h"
+#include "Scratch.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <fstream> 
 #include <iostream>
+#include <queue>
+#include <set>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 #include <assimp/Importer.hpp>
-#include <latch>
-#include <memory>
-#include <thread>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 #include "meshoptimizer.h"
 
-MeshMasher::MeshMasher(Settings settings) : settings(settings),  currBaseInstance(0), sizeEbf(0), sizeVbf(0), primCount(0) {}
+// 64 bit multiplicative hash over 32 bit words, vertex and index data are always a multiple of 4 bytes
+static uint64_t hashGeometry(const void* data, size_t bytes, uint64_t seed) {
+	const uint32_t* words = static_cast<const uint32_t*>(data);
+	uint64_t hash = seed ^ 0x9E3779B97F4A7C15ull;
+	for (size_t i = 0; i < bytes / sizeof(uint32_t); i++)
+		hash = (hash ^ words[i]) * 0x100000001B3ull;
+	return hash ^ (hash >> 32);
+}
+
+static_assert(sizeof(Vertex) == sizeof(PackedVertex), "dat.vbf vertices must match OutputFormat.h");
+
+// cut one buffer into blocks at their final offset in an output file, one write task per block
+static void appendFileBlocks(std::vector<FileRange>& ranges, uint64_t offset, const void* data, size_t size) {
+	const size_t blockSize = 1 << 22;
+	for (size_t block = 0; block < size; block += blockSize)
+		ranges.push_back({ offset + block, static_cast<const char*>(data) + block, std::min(blockSize, size - block) });
+}
+
+const char* getOptLevelName(OptLevel level) {
+	switch (level) {
+	case OptLevel::Fast: return "fast";
+	case OptLevel::Max: return "max";
+	case OptLevel::Strip: return "strip";
+	default: return "balanced";
+	}
+}
+
+bool parseOptLevel(const char* name, OptLevel& level) {
+	for (auto l : { OptLevel::Fast, OptLevel::Balanced, OptLevel::Max, OptLevel::Strip }) {
+		if (strcmp(name, getOptLevelName(l)) == 0) {
+			level = l;
+			return true;
+		}
+	}
+	return false;
+}
+
+MeshMasher::MeshMasher(Settings settings) : settings(settings),  currBaseInstance(0), dedupMeshCount(0), dedupBytes(0), batchedMeshCount(0), batchCount(0), sizeVbf(0), sizeEbf(0), sizeRgb(0), peakArenaBytes(0), sizeSvb(0), sizeSeb(0), busyNanos(0), overdrawSkipped(0), workerStats() {
+	// arenas and mesh lists exist up front so workers can look them up without inserting
+	arenas[MaterialType::Tex];
+	arenas[MaterialType::Opa];
+	meshes[MaterialType::Tex];
+	meshes[MaterialType::Opa];
+}
+
+MeshMasher::~MeshMasher() {
+	stopWorkers();
+}
 
 void MeshMasher::run() {
 	std::ifstream fileContents("contents.txt", std::ios::in);
@@ -24,112 +76,747 @@ void MeshMasher::run() {
 		return;
 	}
 
+	// streaming drops the geometry of every model once it is written, nothing can look at the whole scene afterwards
+	if (settings.streamGeometry && settings.triangleBudget != 0) {
+		std::cout << "Warning: -tri needs the geometry of the whole scene and is ignored with -st 1." << std::endl;
+		settings.triangleBudget = 0;
+	}
+	if (settings.streamGeometry && settings.writeContainer) {
+		std::cout << "Warning: -ct is ignored with -st 1, geometry is streamed to dat.vbf / dat.ebf." << std::endl;
+		settings.writeContainer = false;
+	}
+	if (settings.streamGeometry && settings.compressionLevel != 0)
+		std::cout << "Warning: -lz only compresses dat.rgb with -st 1, geometry is streamed uncompressed to dat.vbf / dat.ebf." << std::endl;
+	// the arenas are dropped right after every flush, io_uring would still be writing from them
+	if (settings.streamGeometry && (settings.writeBackend != WriteBackend::Sync || settings.directIo))
+		std::cout << "Warning: -io / -dio do not apply to the geometry streamed with -st 1, dat.vbf / dat.ebf are written with pwrite." << std::endl;
+
+	startWorkers();
+	if (settings.streamGeometry)
+		startStreaming();
+
+	// Read each file name and start assigning threads work to store all that data into model struct vectors and other members
+	std::string modelName;
+	std::set<std::string> fileNames;
+	while (std::getline(fileContents, modelName)) {
+		if (!fileNames.insert(modelName).second) {
+			std::cout << "'" << modelName << "' is listed more than once. Skipping......." << std::endl;
+			continue;
+		}
+
+		Assimp::Importer importer;
+		const auto scene = importer.ReadFile(("input/" + modelName).c_str(), getImportFlags());
+		if (scene != nullptr) {
+
+			//remove extension (.obj, gltf) from filename to get modelname
+			//models sharing a name (Sponza.gltf, Sponza.obj) get a numbered suffix, everything is keyed by it
+			std::string baseName = modelName.substr(0, modelName.find('.'));
+			if (baseName.empty())
+				baseName = modelName;
+			modelName = baseName;
+			for (unsigned int n = 2; modelBaseInstances.count(modelName) != 0; n++)
+				modelName = baseName + "_" + std::to_string(n);
+			processModel(scene, modelName);
+			if (settings.streamGeometry)
+				flushGeometry();
+		}
+		else {
+			std::cout << "Error: '" << modelName << "' not found. Skipping......." << std::endl;
+		}
+	}
+
+	std::cout << "\n-------------------------------\n";
+	std::cout << "Finished mashing all meshes, writing to files...." << std::endl;
+	if (settings.triangleBudget != 0)
+		applyTriangleBudget();
+	writeOutput();
+	stopWorkers();
+
+	std::cout << "Finished writing to files. You can close this application now...." << std::endl;
+}
+
+unsigned int MeshMasher::getImportFlags() const {
+	unsigned int processPreset = aiProcessPreset_TargetRealtime_Quality;
+
+	// meshoptimizer already dedups vertices (remapMesh), orders triangles for the vertex cache (loadMesh) and splits big meshes (-cs)
+	// so with -mo 1 assimp only does what MeshMasher can't, dropping JoinIdenticalVertices, ImproveCacheLocality and SplitLargeMeshes.
+	// tangents and bone weights are never written so CalcTangentSpace and LimitBoneWeights go too
+	if (settings.useMeshOptimizer)
+		processPreset = aiProcess_Triangulate |
+			aiProcess_GenSmoothNormals |
+			aiProcess_GenUVCoords |
+			aiProcess_SortByPType |
+			aiProcess_FindDegenerates |
+			aiProcess_FindInvalidData |
+			aiProcess_RemoveRedundantMaterials;
+
+	if (settings.preTransformVertices)
+		processPreset |= aiProcess_PreTransformVertices;
+	return processPreset;
+}
+
+void MeshMasher::startWorkers() {
+	// meshoptimizer's internal allocations go through the scratch arena of the calling worker
+	meshopt_setAllocator(scratchAllocate, scratchDeallocate);
+
 	// init worker threads with thier func
-	std::unique_ptr<std::latch> latchThreads;
-	std::vector<std::jthread> threads;
-	for (int i = 0; i < settings.numWorkerThreads; i++) {
-		threads.emplace_back([&]() {
+	for (unsigned int i = 0; i < settings.numWorkerThreads; i++) {
+		threads.emplace_back([this]() {
 			while (true) {
 				Command* com = cqueue.pop();
+				if (com == nullptr)																	// pushed by stopWorkers()
+					break;
+				getScratch().reset();
+				auto start = std::chrono::steady_clock::now();
 				com->execute();
+				busyNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
 				delete com;
 				latchThreads->count_down();
 			}
 			});
 	};
+}
 
-	// Read each file name and start assigning threads work to store all that data into model struct vectors and other members
-	std::string modelName;
-	while (std::getline(fileContents, modelName)) {
-		Assimp::Importer importer;
-		
-		int processPreset = settings.preTransformVertices ? 
-			aiProcessPreset_TargetRealtime_Quality | aiProcess_PreTransformVertices :
-			aiProcessPreset_TargetRealtime_Quality;
+void MeshMasher::stopWorkers() {
+	for (size_t i = 0; i < threads.size(); i++)
+		cqueue.push(nullptr);
+	threads.clear();
+}
 
-		const auto scene = importer.ReadFile(("input/" + modelName).c_str(), processPreset);
-		if (scene != nullptr) {
+void MeshMasher::runPass(std::vector<std::pair<size_t, Command*>>& tasks) {
+	// longest processing time first, the big tasks start right away and the small ones fill in the gaps at the end of the pass
+	// instead of one big task pushed last keeping every other worker waiting on the latch. stable so equal costs keep scene order
+	if (settings.largestFirst)
+		std::stable_sort(tasks.begin(), tasks.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
 
-			//remove extension (.obj, gltf) from filename to get modelname
-			modelName = modelName.substr(0, modelName.find('.'));
-			modelBaseInstances[modelName] = currBaseInstance++;
-			std::cout << "-------------------------------\n" << modelName << std::endl;
-
-			// process materials first so that we can identify which meshes are of what type
-			materials[modelName].resize(scene->mNumMaterials);
-			latchThreads = std::make_unique<std::latch>(scene->mNumMaterials);
-			for (unsigned int i = 0; i < scene->mNumMaterials; i++)
-				cqueue.push(new CModelInt(this, &MeshMasher::loadMaterial, scene->mMaterials[i], materials[modelName][i]));
-			latchThreads->wait();
-			latchThreads.reset();
-			std::cout << "Materials processed." << std::endl;
-
-			// process meshes
-			latchThreads = std::make_unique<std::latch>(scene->mNumMeshes);
-
-			// reserve space for meshes which can then be copied to the member "meshes" std::map
-			std::map<MaterialType, std::vector<Mesh>> tempMeshes;
-			std::map<MaterialType, unsigned int> perMatIndex;														//num meshes per material. Used for generating indexes
-			for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
-				auto matType = materials[modelName][scene->mMeshes[i]->mMaterialIndex].type;
-				tempMeshes[matType].emplace_back(Mesh(modelName));
+	auto start = std::chrono::steady_clock::now();
+	long long busyStart = busyNanos;
+	latchThreads = std::make_unique<std::latch>(tasks.size());
+	for (auto& t : tasks)
+		cqueue.push(t.second);
+	latchThreads->wait();
+	latchThreads.reset();
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	workerStats.busySeconds += (busyNanos - busyStart) * 1e-9;
+	workerStats.workerSeconds += seconds * threads.size();
+	workerStats.numPasses++;
+}
+
+WorkerStats MeshMasher::getWorkerStats() const {
+	return workerStats;
+}
+
+void MeshMasher::processModel(const aiScene* scene, const std::string& modelName) {
+	modelBaseInstances[modelName] = currBaseInstance++;
+	std::cout << "-------------------------------\n" << modelName << std::endl;
+
+	// process materials first so that we can identify which meshes are of what type
+	materials[modelName].resize(scene->mNumMaterials);
+	std::vector<std::pair<size_t, Command*>> tasks;
+	for (unsigned int i = 0; i < scene->mNumMaterials; i++)
+		tasks.emplace_back(estimateMaterialCost(scene->mMaterials[i]), new CModelInt(this, &MeshMasher::loadMaterial, scene->mMaterials[i], materials[modelName][i]));
+	runPass(tasks);
+	std::cout << "Materials processed." << std::endl;
+
+	// every node referencing a mesh is one instance of it, so a mesh shared by many nodes is processed and written once and drawn instanced.
+	// with -ptv 1 assimp already baked the transforms and each mesh is referenced once with an identity transform
+	std::vector<std::vector<aiMatrix4x4>> meshInstances(scene->mNumMeshes);
+	if (scene->mRootNode != nullptr)
+		collectInstances(scene->mRootNode, aiMatrix4x4(), meshInstances);
+	std::vector<unsigned int> firstInstances(scene->mNumMeshes);
+	unsigned int numInstanced = 0;
+	for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+		firstInstances[i] = static_cast<unsigned int>(instanceTransforms.size());
+		instanceTransforms.insert(instanceTransforms.end(), meshInstances[i].begin(), meshInstances[i].end());
+		if (meshInstances[i].size() > 1)
+			numInstanced++;
+	}
+	if (numInstanced != 0)
+		std::cout << numInstanced << " meshes referenced by several nodes are drawn instanced." << std::endl;
+
+	// process meshes
+	// records go straight into the member "meshes" std::map in the original order and are not copied again
+	// meshes above settings.chunkTriangles become several consecutive records, one per spatially coherent chunk, each drawn on its own
+	std::map<MaterialType, size_t> perMatIndex;																//first record of this model per material. Used for generating indexes
+	for (auto& m : meshes)
+		perMatIndex[m.first] = m.second.size();
+	std::vector<unsigned int> numChunks(scene->mNumMeshes);
+	for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+		const aiMesh* aimesh = scene->mMeshes[i];
+		auto matType = materials[modelName][aimesh->mMaterialIndex].type;
+		numChunks[i] = getNumChunks(aimesh);
+
+		unsigned int firstFace = 0;
+		for (unsigned int c = 0; c < numChunks[i]; c++) {
+			unsigned int chunkFaces = (aimesh->mNumFaces - firstFace) / (numChunks[i] - c);
+			Mesh& mesh = meshes[matType].emplace_back(Mesh(modelName, matType));
+			mesh.materialIndex = aimesh->mMaterialIndex;
+			mesh.firstInstance = firstInstances[i];
+			mesh.instanceCount = static_cast<unsigned int>(meshInstances[i].size());
+			mesh.vertexCount = aimesh->mNumVertices;
+			mesh.indexCount = chunkFaces * 3;
+			mesh.isChunk = numChunks[i] > 1;
+			firstFace += chunkFaces;
+		}
+	}
+
+	// records are only addressed once all of them are in place
+	std::vector<std::pair<const aiMesh*, Mesh*>> modelMeshes, splitMeshes;
+	for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+		auto matType = materials[modelName][scene->mMeshes[i]->mMaterialIndex].type;
+		if (numChunks[i] > 1)
+			splitMeshes.emplace_back(scene->mMeshes[i], &meshes[matType][perMatIndex[matType]]);
+		for (unsigned int c = 0; c < numChunks[i]; c++)
+			modelMeshes.emplace_back(scene->mMeshes[i], &meshes[matType][perMatIndex[matType]++]);
+	}
+
+	// index counts are known up front, vertex counts only once meshoptimizer has remapped the mesh
+	// every mesh pass scales with the indices and vertices of a record, that is the cost used to order the tasks
+	planIndexRanges(modelMeshes);
+	if (!splitMeshes.empty()) {
+		tasks.clear();
+		for (auto& m : splitMeshes)
+			tasks.emplace_back(static_cast<size_t>(m.first->mNumFaces) * 3 + m.first->mNumVertices, new CAIMeshMesh(this, &MeshMasher::splitMesh, m.first, *m.second));
+		runPass(tasks);
+	}
+	if (settings.useMeshOptimizer) {
+		tasks.clear();
+		for (auto& m : modelMeshes)
+			tasks.emplace_back(static_cast<size_t>(m.second->indexCount) + m.first->mNumVertices, new CAIMeshMesh(this, &MeshMasher::remapMesh, m.first, *m.second));
+		runPass(tasks);
+	}
+	planVertexRanges(modelMeshes);
+
+	// now send them to threads to write their geometry straight into the arenas
+	tasks.clear();
+	for (auto& m : modelMeshes)
+		tasks.emplace_back(static_cast<size_t>(m.second->indexCount) + m.second->vertexCount, new CAIMeshMesh(this, &MeshMasher::loadMesh, m.first, *m.second));
+	runPass(tasks);
+	if (settings.batchTriangles != 0)
+		batchMeshes(modelMeshes);
+	dedupMeshes(modelMeshes);
+
+	std::cout << "Meshes processed." << std::endl;
+}
+
+void MeshMasher::applyTriangleBudget() {
+	// one entry per distinct index range, records sharing a deduplicated range are simplified once and weighted by all their instances
+	struct BudgetRange {
+		Mesh* mesh;
+		size_t weight;
+		unsigned int level;																	// 0 = full detail, else mesh->lods[level - 1]
+	};
+	std::map<std::pair<MaterialType, unsigned int>, size_t> rangeIndex;						// (matType, firstIndex), sorted like the index arenas
+	std::vector<BudgetRange> ranges;
+	size_t drawnBefore = 0;
+	for (auto& mm : meshes) {
+		for (auto& m : mm.second) {
+			if (m.indexCount == 0)
+				continue;
+			auto range = rangeIndex.emplace(std::make_pair(m.matType, m.firstIndex), ranges.size());
+			if (range.second)
+				ranges.push_back({ &m, 0, 0 });
+			ranges[range.first->second].weight += m.instanceCount;
+			drawnBefore += static_cast<size_t>(m.indexCount / 3) * m.instanceCount;
+		}
+	}
+	if (drawnBefore <= settings.triangleBudget) {
+		std::cout << "Triangle budget : " << drawnBefore << " triangles drawn, already within the budget of " << settings.triangleBudget << std::endl;
+		return;
+	}
+
+	// every mesh gets its chain of simplified levels in parallel
+	std::vector<std::pair<size_t, Command*>> tasks;
+	for (auto& r : ranges)
+		tasks.emplace_back(r.mesh->indexCount, new CMesh(this, &MeshMasher::simplifyMesh, *r.mesh));
+	runPass(tasks);
+
+	// greedy over all meshes of all models: always take the next level that adds the least error per triangle it saves.
+	// object space error stands in for screen space error at a common viewing distance, weighted by how often the range is drawn
+	auto triangles = [](const BudgetRange& r, unsigned int level) { return (level == 0 ? r.mesh->indexCount : r.mesh->lods[level - 1].indices.size()) / 3; };
+	auto error = [](const BudgetRange& r, unsigned int level) { return level == 0 ? 0.0 : r.mesh->lods[level - 1].error; };
+	std::priority_queue<std::pair<double, size_t>, std::vector<std::pair<double, size_t>>, std::greater<std::pair<double, size_t>>> steps;
+	auto pushStep = [&](size_t i) {
+		const BudgetRange& r = ranges[i];
+		if (r.level >= r.mesh->lods.size() || r.weight == 0)
+			return;
+		double saved = static_cast<double>(triangles(r, r.level) - triangles(r, r.level + 1)) * r.weight;
+		steps.push({ (error(r, r.level + 1) - error(r, r.level)) * r.weight / saved, i });
+	};
+	for (size_t i = 0; i < ranges.size(); i++)
+		pushStep(i);
+
+	size_t drawn = drawnBefore;
+	while (drawn > settings.triangleBudget && !steps.empty()) {
+		size_t i = steps.top().second;
+		steps.pop();
+		BudgetRange& r = ranges[i];
+		drawn -= (triangles(r, r.level) - triangles(r, r.level + 1)) * r.weight;
+		r.level++;
+		pushStep(i);
+	}
+
+	// rebuild the index arenas with the chosen level of every range, vertex ranges stay as they are
+	std::map<std::pair<MaterialType, unsigned int>, std::pair<unsigned int, unsigned int>> newRanges;	// old firstIndex -> new firstIndex / indexCount
+	std::map<MaterialType, std::vector<unsigned int>> newIndices;
+	unsigned int numSimplified = 0;
+	double maxError = 0.0;
+	for (auto& ri : rangeIndex) {
+		BudgetRange& r = ranges[ri.second];
+		auto& indices = newIndices[ri.first.first];
+		auto firstIndex = static_cast<unsigned int>(indices.size());
+		if (r.level == 0) {
+			auto& arenaIndices = arenas[ri.first.first].indices;
+			indices.insert(indices.end(), arenaIndices.begin() + r.mesh->firstIndex, arenaIndices.begin() + r.mesh->firstIndex + r.mesh->indexCount);
+		}
+		else {
+			auto& lod = r.mesh->lods[r.level - 1];
+			indices.insert(indices.end(), lod.indices.begin(), lod.indices.end());
+			maxError = std::max<double>(maxError, lod.error);
+			numSimplified++;
+		}
+		newRanges[ri.first] = { firstIndex, static_cast<unsigned int>(indices.size()) - firstIndex };
+	}
+	for (auto& mm : meshes) {
+		for (auto& m : mm.second) {
+			std::vector<MeshLod>().swap(m.lods);
+			if (m.indexCount == 0) {
+				m.firstIndex = 0;
+				continue;
 			}
+			auto range = newRanges[std::make_pair(m.matType, m.firstIndex)];
+			m.firstIndex = range.first;
+			m.indexCount = range.second;
+		}
+	}
+	for (auto& a : arenas)
+		a.second.indices.swap(newIndices[a.first]);
+
+	// shadow indices and the report numbers were built from the full detail indices
+	if (settings.writeShadowData || settings.writeReport) {
+		tasks.clear();
+		for (auto& mm : meshes)
+			for (auto& m : mm.second)
+				tasks.emplace_back(m.indexCount, new CMesh(this, &MeshMasher::refreshBudgetMesh, m));
+		runPass(tasks);
+	}
+
+	std::cout << "Triangle budget : " << drawnBefore << " -> " << drawn << " triangles drawn for a budget of " << settings.triangleBudget << ", "
+		<< numSimplified << " meshes simplified, largest error " << maxError << std::endl;
+	if (drawn > settings.triangleBudget)
+		std::cout << "Warning: meshes can not be simplified any further, the scene stays over the triangle budget." << std::endl;
+}
 
-			// now send them to threads to load up data in order, mantain the original order of meshes
-			for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
-				auto matType = materials[modelName][scene->mMeshes[i]->mMaterialIndex].type;
-				cqueue.push(new CAIMeshMesh(this, &MeshMasher::loadMesh, scene->mMeshes[i], tempMeshes[matType][perMatIndex[matType]++]));
+void MeshMasher::startStreaming() {
+	// tex geometry goes straight into dat.vbf / dat.ebf, opa geometry into temporary files that finishStreaming appends behind it
+	for (auto& a : arenas) {
+		std::string suffix = a.first == MaterialType::Opa ? ".opa" : "";
+		GeometryStream& stream = streams[a.first];
+		if (!stream.vertices.open("output/dat.vbf" + suffix, 0) || !stream.indices.open("output/dat.ebf" + suffix, 0))
+			std::cout << "Error: " << "streamed geometry files failed on creation." << std::endl;
+	}
+}
+
+void MeshMasher::flushGeometry() {
+	// the ranges of the model that just finished are the only ones left in the arenas. every worker writes blocks of them at their
+	// final offset in the stream of their material type, then they are dropped. records keep their arena wide offsets
+	std::vector<std::pair<size_t, Command*>> tasks;
+	size_t arenaBytes = 0;
+	for (auto& a : arenas) {
+		GeometryArena& arena = a.second;
+		GeometryStream& stream = streams[a.first];
+		std::vector<FileRange> vertexRanges, indexRanges;
+		appendFileBlocks(vertexRanges, sizeof(Vertex) * arena.flushedVertices, arena.vertices.data(), sizeof(Vertex) * arena.vertices.size());
+		appendFileBlocks(indexRanges, sizeof(unsigned int) * arena.flushedIndices, arena.indices.data(), sizeof(unsigned int) * arena.indices.size());
+		for (auto& range : vertexRanges)
+			tasks.emplace_back(range.size, new CFileRange(this, &MeshMasher::writeFileRange, stream.vertices, range));
+		for (auto& range : indexRanges)
+			tasks.emplace_back(range.size, new CFileRange(this, &MeshMasher::writeFileRange, stream.indices, range));
+		arenaBytes += sizeof(Vertex) * arena.vertices.capacity() + sizeof(unsigned int) * arena.indices.capacity();
+	}
+	runPass(tasks);
+	peakArenaBytes = std::max(peakArenaBytes, arenaBytes);
+
+	for (auto& a : arenas) {
+		a.second.flushedVertices = a.second.vertexEnd();
+		a.second.flushedIndices = a.second.indexEnd();
+		std::vector<Vertex>().swap(a.second.vertices);
+		std::vector<unsigned int>().swap(a.second.indices);
+	}
+}
+
+void MeshMasher::finishStreaming() {
+	// opa geometry is appended behind the tex geometry, the layout of the non streamed files. records of opa meshes stay
+	// relative to the start of their arena like before
+	std::vector<char> buffer(1 << 22);
+	auto append = [&](OutputFile& file, uint64_t offset, OutputFile& temp) {
+		std::string tempPath = temp.getPath();
+		if (!temp.close())
+			std::cout << "Error: " << tempPath << " failed on write." << std::endl;
+
+		std::ifstream ifile(tempPath, std::fstream::in | std::fstream::binary);
+		while (ifile.read(buffer.data(), buffer.size()) || ifile.gcount() > 0) {
+			file.write(offset, buffer.data(), static_cast<size_t>(ifile.gcount()));
+			offset += static_cast<uint64_t>(ifile.gcount());
+		}
+		ifile.close();
+		std::remove(tempPath.c_str());
+		if (!file.close())
+			std::cout << "Error: " << file.getPath() << " failed on write." << std::endl;
+	};
+	append(streams[MaterialType::Tex].vertices, sizeof(Vertex) * arenas[MaterialType::Tex].vertexEnd(), streams[MaterialType::Opa].vertices);
+	append(streams[MaterialType::Tex].indices, sizeof(unsigned int) * arenas[MaterialType::Tex].indexEnd(), streams[MaterialType::Opa].indices);
+
+	std::cout << "Streaming : geometry written after every model, largest arenas held in memory " << peakArenaBytes << " bytes" << std::endl;
+}
+
+void MeshMasher::writeOutput() {
+	if (settings.streamGeometry)
+		finishStreaming();
+
+	// every size the loader files refer to is known before any writer runs, so the writers do not depend on each other
+	sizeVbf = sizeEbf = 0;
+	for (auto& a : arenas) {
+		sizeVbf += sizeof(Vertex) * a.second.vertexEnd();
+		sizeEbf += sizeof(unsigned int) * a.second.indexEnd();
+	}
+	planTextures();
+	planMaterials();
+	if (settings.writeShadowData)
+		planShadowRanges();
+	if (settings.compressionLevel != 0)
+		compressOutput();
+
+	//start writing to files, the cost of each writer is the bytes it writes. the container writes its sections in file order
+	// files split into ranges are preallocated and every worker writes its ranges at their final offset
+	std::vector<std::pair<size_t, Command*>> tasks;
+	std::vector<std::unique_ptr<OutputFile>> files;
+	if (settings.writeContainer)
+		tasks.emplace_back(sizeVbf + sizeEbf, new CVoid(this, &MeshMasher::writeContainerData));
+	else {
+		for (auto& section : getOutputSections()) {
+			std::string path = std::string("output/dat.") + section.name;
+			if (section.ranges.empty()) {
+				tasks.emplace_back(section.cost, new CWriter(this, section.writer, path));
+				continue;
 			}
-			latchThreads->wait();
-			latchThreads.reset();
 
-			// now combine it to the member "meshes" std::map
-			for (auto& m : tempMeshes) {
-				meshes[m.first].insert(meshes[m.first].end(), m.second.begin(), m.second.end());
+			files.push_back(std::make_unique<OutputFile>());
+			if (!files.back()->open(path, section.cost, settings.writeBackend, settings.directIo)) {
+				std::cout << "Error: " << path << " failed on creation." << std::endl;
+				continue;
 			}
+			if (files.back()->getBackend() != settings.writeBackend)
+				std::cout << "Warning: io_uring is not available, " << path << " falls back to synchronous writes." << std::endl;
+			else if (settings.writeBackend == WriteBackend::Uring && settings.directIo && !files.back()->isDirect())
+				std::cout << "Warning: O_DIRECT is not supported for " << path << ", writing through the page cache." << std::endl;
+			for (auto& range : section.ranges)
+				tasks.emplace_back(range.size, new CFileRange(this, &MeshMasher::writeFileRange, *files.back(), range));
+		}
+	}
+	if (settings.writeReport)
+		tasks.emplace_back(0, new CVoid(this, &MeshMasher::writeReportData));
+	runPass(tasks);
 
-			std::cout << "Meshes processed." << std::endl;
+	for (auto& file : files) {
+		if (!file->close())
+			std::cout << "Error: " << file->getPath() << " failed on write." << std::endl;
+	}
+	compressedFiles.clear();
 
+	for (auto& t : textures) {
+		if (t.second.data != nullptr) {
+			stbi_image_free(t.second.data);
+			t.second.data = nullptr;
 		}
-		else {
-			std::cout << "Error: '" << modelName << "' not found. Skipping......." << std::endl;
+	}
+
+	auto scratchStats = getScratchStats();
+	std::cout << "Scratch allocations : " << scratchStats.scratchAllocations << " served by worker scratch, "
+		<< scratchStats.heapAllocations << " fell back to the heap (" << scratchStats.heapBytes << " bytes)" << std::endl;
+
+	if (workerStats.workerSeconds > 0.0) {
+		double idleSeconds = std::max(0.0, workerStats.workerSeconds - workerStats.busySeconds);
+		std::cout << "Worker idle time : " << idleSeconds << " s of " << workerStats.workerSeconds << " s over " << workerStats.numPasses << " passes ("
+			<< 100.0 * idleSeconds / workerStats.workerSeconds << "%, " << (settings.largestFirst ? "largest first" : "scene order") << ")" << std::endl;
+	}
+	if (batchCount != 0)
+		std::cout << "Batching : " << batchedMeshCount << " small meshes merged into " << batchCount << " draws" << std::endl;
+	if (dedupMeshCount != 0)
+		std::cout << "Duplicate meshes : " << dedupMeshCount << " share the geometry of an identical mesh, " << dedupBytes << " bytes not written" << std::endl;
+	if (settings.meshTimeBudget != 0)
+		std::cout << "Overdraw optimization skipped on " << overdrawSkipped << " meshes over the " << settings.meshTimeBudget << " ms budget" << std::endl;
+}
+
+std::vector<MeshMasher::OutputSection> MeshMasher::getOutputSections() const {
+	// the order of the sections in dat.mmc, dat.ldr first so a loader can size its buffers before mapping the rest
+	// a compressed file is written from its ranges, the head and every chunk at their final offset
+	auto compressedSection = [this](const char* name, const char* rawName) {
+		const CompressedFile& file = compressedFiles.at(rawName);
+		OutputSection section = { name, nullptr, file.size, { { 0, file.head.data(), file.head.size() } } };
+		for (size_t c = 0; c < file.chunks.size(); c++)
+			section.ranges.push_back({ file.index[c].offset, file.chunks[c].data(), file.chunks[c].size() });
+		return section;
+	};
+
+	// with -st 1 dat.vbf / dat.ebf are already written
+	std::vector<OutputSection> sections = { { "ldr", &MeshMasher::writeLoaderData, 0 } };
+	if (!settings.streamGeometry && settings.compressionLevel != 0) {
+		sections.push_back(compressedSection("vbz", "vbf"));
+		sections.push_back(compressedSection("ebz", "ebf"));
+	}
+	else if (!settings.streamGeometry) {
+		sections.push_back({ "vbf", &MeshMasher::writeVBufferData, sizeVbf, getArenaRanges(false) });
+		sections.push_back({ "ebf", &MeshMasher::writeEBufferData, sizeEbf, getArenaRanges(true) });
+	}
+	sections.push_back({ "ins", &MeshMasher::writeInstanceData, sizeof(float) * 16 * instanceTransforms.size() });
+	sections.push_back({ "mtr", &MeshMasher::writeMaterialData, sizeof(MaterialHeader) + sizeof(MaterialRecord) * materialTable.size() });
+	sections.push_back({ "txr", &MeshMasher::writeTextureData, 0 });
+	if (settings.compressionLevel != 0)
+		sections.push_back(compressedSection("rgz", "rgb"));
+	else
+		sections.push_back({ "rgb", &MeshMasher::writeImageData, sizeRgb });
+	if (settings.writeShadowData) {
+		sections.push_back({ "sdr", &MeshMasher::writeShadowLoaderData, 0 });
+		sections.push_back({ "svb", &MeshMasher::writeShadowVBufferData, sizeSvb });
+		sections.push_back({ "seb", &MeshMasher::writeShadowEBufferData, sizeSeb });
+	}
+	return sections;
+}
+
+std::vector<FileRange> MeshMasher::getArenaRanges(bool indices) const {
+	// the vertex / index arenas cut into blocks at their final offset in dat.vbf / dat.ebf
+	// opaque materials need to be last and this order must match in other writefunx()
+	std::vector<FileRange> ranges;
+	uint64_t offset = 0;
+	std::vector<MaterialType> matTypes{ MaterialType::Tex, MaterialType::Opa };
+	for (auto it = matTypes.begin(); it != matTypes.end(); it++) {
+		auto arena = arenas.find(*it);
+		if (arena == arenas.end())
+			continue;
+
+		const void* data = indices ? static_cast<const void*>(arena->second.indices.data()) : static_cast<const void*>(arena->second.vertices.data());
+		size_t size = indices ? sizeof(unsigned int) * arena->second.indices.size() : sizeof(Vertex) * arena->second.vertices.size();
+		appendFileBlocks(ranges, offset, data, size);
+		offset += size;
+	}
+	return ranges;
+}
+
+void MeshMasher::planTextures() {
+	// every decoded texture in name order, textures that failed to load are left out. sizes come from the decoded
+	// dimensions and stb channel count, each texture starts on a 16 byte boundary of dat.rgb
+	textureTable.clear();
+	mipTable.clear();
+	textureIndices.clear();
+	uint64_t end = 0;
+	uint32_t nameOffset = 0;
+	for (auto& t : textures) {
+		if (t.second.data == nullptr)
+			continue;
+		TextureEntry entry = {};
+		entry.offset = (end + 15) & ~uint64_t(15);
+		entry.width = static_cast<uint32_t>(t.second.width);
+		entry.height = static_cast<uint32_t>(t.second.height);
+		entry.channels = static_cast<uint32_t>(t.second.rgbType);
+		entry.format = entry.channels == 4 ? TextureRGBA8 : TextureRGB8;
+		entry.size = uint64_t(entry.width) * entry.height * entry.channels;
+		entry.firstMip = static_cast<uint32_t>(mipTable.size());
+		entry.numMips = 1;																	// only the decoded level, loaders generate the rest
+		entry.nameOffset = nameOffset;
+		entry.nameLength = static_cast<uint32_t>(t.first.size());
+		nameOffset += entry.nameLength;
+
+		mipTable.push_back({ entry.offset, entry.size, entry.width, entry.height });
+		textureIndices[t.first] = static_cast<int32_t>(textureTable.size());
+		textureTable.push_back(entry);
+		end = entry.offset + entry.size;
+	}
+	sizeRgb = end;
+}
+
+void MeshMasher::planMaterials() {
+	// texture indices are the entries of dat.txr
+	auto getTextureIndex = [&](const Material& mat, aiTextureType textureType) {
+		auto name = mat.textureNames.find(textureType);
+		if (name == mat.textureNames.end() || textureIndices.count(name->second) == 0)
+			return -1;
+		return textureIndices.at(name->second);
+	};
+
+	// identical records are shared by every model using them, the record bytes are the key
+	std::map<std::string, uint32_t> uniqueRecords;
+	size_t numMaterials = 0;
+	materialTable.clear();
+	materialIds.clear();
+	for (auto& m : materials) {
+		for (auto& mat : m.second) {
+			MaterialRecord record = {};
+			std::copy(mat.color, mat.color + 4, record.color);
+			record.opacity = mat.opacity;
+			record.flags = (mat.type == MaterialType::Opa ? MaterialBlend : 0) | (mat.useAlphaTex ? MaterialAlphaTexture : 0) |
+				(mat.useDiffuseAlpha ? MaterialDiffuseAlpha : 0);
+			record.diffuseTexture = getTextureIndex(mat, aiTextureType_DIFFUSE);
+			record.normalTexture = getTextureIndex(mat, aiTextureType_NORMALS);
+			record.emissiveTexture = getTextureIndex(mat, aiTextureType_EMISSIVE);
+			record.opacityTexture = getTextureIndex(mat, aiTextureType_OPACITY);
+
+			auto unique = uniqueRecords.emplace(std::string(reinterpret_cast<const char*>(&record), sizeof(record)), static_cast<uint32_t>(materialTable.size()));
+			if (unique.second)
+				materialTable.push_back(record);
+			materialIds[m.first].push_back(unique.first->second);
+			numMaterials++;
 		}
 	}
+	std::cout << "Material table : " << materialTable.size() << " unique of " << numMaterials << " materials" << std::endl;
+}
 
-	std::cout << "\n-------------------------------\n";
-	std::cout << "Finished mashing all meshes, writing to files...." << std::endl;
-	
-	//start writing to files
-	latchThreads = std::make_unique<std::latch>(4);
-	cqueue.push(new CVoid(this, &MeshMasher::writeVBufferData));
-	cqueue.push(new CVoid(this, &MeshMasher::writeEBufferData));
-	cqueue.push(new CVoid(this, &MeshMasher::writeMaterialData));
-	cqueue.push(new CVoid(this, &MeshMasher::writeTextureData));
-	latchThreads->wait();
+void MeshMasher::compressOutput() {
+	// the chunks of every compressed file in one pass, each chunk copies its raw bytes together from the source ranges
+	compressedFiles.clear();
+	if (!settings.streamGeometry) {
+		compressedFiles["vbf"].source = getArenaRanges(false);
+		compressedFiles["vbf"].rawSize = sizeVbf;
+		compressedFiles["ebf"].source = getArenaRanges(true);
+		compressedFiles["ebf"].rawSize = sizeEbf;
+	}
+	CompressedFile& rgb = compressedFiles["rgb"];
+	for (auto& t : textureIndices) {
+		const TextureEntry& entry = textureTable[t.second];
+		rgb.source.push_back({ entry.offset, textures.at(t.first).data, entry.size });
+	}
+	rgb.rawSize = sizeRgb;
 
-	// must come after writing other files 
-	writeLoaderData();
+	std::vector<std::pair<size_t, Command*>> tasks;
+	for (auto& f : compressedFiles) {
+		CompressedFile& file = f.second;
+		size_t numChunks = static_cast<size_t>((file.rawSize + CompressedChunkSize - 1) / CompressedChunkSize);
+		file.level = static_cast<int>(settings.compressionLevel);
+		file.chunks.resize(numChunks);
+		file.index.resize(numChunks);
+		for (size_t c = 0; c < numChunks; c++)
+			tasks.emplace_back(std::min<uint64_t>(CompressedChunkSize, file.rawSize - c * CompressedChunkSize), new CCompressChunk(this, &MeshMasher::compressChunk, file, c));
+	}
+	auto start = std::chrono::steady_clock::now();
+	runPass(tasks);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-	std::cout << "Finished writing to files. You can close this application now...." << std::endl;
+	// chunk data is packed behind the 16 byte aligned index
+	uint64_t rawBytes = 0, compressedBytes = 0;
+	for (auto& f : compressedFiles) {
+		CompressedFile& file = f.second;
+		CompressedHeader header = { { 'M', 'M', 'L', 'Z' }, CompressedVersion, static_cast<uint32_t>(file.level), CompressedChunkSize, file.rawSize,
+			static_cast<uint32_t>(file.chunks.size()), 0, sizeof(CompressedHeader) };
+		uint64_t offset = (sizeof(CompressedHeader) + sizeof(CompressedChunk) * file.index.size() + 15) & ~uint64_t(15);
+		for (auto& chunk : file.index) {
+			chunk.offset = offset;
+			offset += chunk.size;
+		}
+		file.size = offset;
+		file.head.assign(static_cast<size_t>(file.index.empty() ? offset : file.index[0].offset), 0);
+		memcpy(file.head.data(), &header, sizeof(header));
+		if (!file.index.empty())
+			memcpy(file.head.data() + sizeof(header), file.index.data(), sizeof(CompressedChunk) * file.index.size());
+
+		rawBytes += file.rawSize;
+		compressedBytes += file.size;
+		std::cout << "Compression : dat." << f.first << " " << file.rawSize << " -> " << file.size << " bytes ("
+			<< (file.rawSize ? 100.0 * file.size / file.rawSize : 100.0) << "%), " << file.chunks.size() << " chunks" << std::endl;
+	}
+	std::cout << "Compression : level " << settings.compressionLevel << ", " << rawBytes << " -> " << compressedBytes << " bytes in " << seconds << " s ("
+		<< (seconds > 0.0 ? rawBytes / seconds / (1024.0 * 1024.0) : 0.0) << " MB/s)" << std::endl;
+}
+
+void MeshMasher::compressChunk(CompressedFile& file, size_t chunk) {
+	// the raw bytes of the chunk, gaps between the source ranges (texture padding) stay zero
+	uint64_t begin = uint64_t(chunk) * CompressedChunkSize;
+	size_t rawSize = static_cast<size_t>(std::min<uint64_t>(CompressedChunkSize, file.rawSize - begin));
+	std::vector<char> raw(rawSize);
+	auto range = std::partition_point(file.source.begin(), file.source.end(), [&](const FileRange& r) { return r.offset + r.size <= begin; });
+	for (; range != file.source.end() && range->offset < begin + rawSize; range++) {
+		uint64_t from = std::max(begin, range->offset), to = std::min(begin + rawSize, range->offset + range->size);
+		memcpy(raw.data() + (from - begin), static_cast<const char*>(range->data) + (from - range->offset), static_cast<size_t>(to - from));
+	}
+
+	std::vector<char>& compressed = file.chunks[chunk];
+	compressed.resize(getCompressBound(rawSize));
+	size_t size = compressBlock(raw.data(), rawSize, compressed.data(), compressed.size(), file.level);
+	if (size == 0 || size >= rawSize) {
+		compressed = std::move(raw);
+		file.index[chunk] = { 0, static_cast<uint32_t>(rawSize), CompressedStored };
+	}
+	else {
+		compressed.resize(size);
+		compressed.shrink_to_fit();
+		file.index[chunk] = { 0, static_cast<uint32_t>(size), 0 };
+	}
+}
+
+void MeshMasher::planShadowRanges() {
+	// records sharing a deduplicated range share its shadow range too, keyed by the range in the vertex arena
+	// opaque materials need to be last and this order must match in other writefunx()
+	std::map<std::pair<MaterialType, unsigned int>, size_t> owners;						// -> index of the owning record in shadowRanges
+	unsigned int baseVertex = 0, firstIndex = 0;
+	shadowRanges.clear();
+	std::vector<MaterialType> matTypes{ MaterialType::Tex, MaterialType::Opa };
+	for (auto it = matTypes.begin(); it != matTypes.end(); it++) {
+		for (auto& m : meshes.at(*it)) {
+			auto owner = owners.emplace(std::make_pair(*it, m.baseVertex), shadowRanges.size());
+			if (owner.second) {
+				shadowRanges.push_back({ &m, baseVertex, firstIndex, true });
+				baseVertex += static_cast<unsigned int>(m.shadowVertices.size());
+				firstIndex += static_cast<unsigned int>(m.shadowIndices.size());
+			}
+			else {
+				ShadowRange shared = shadowRanges[owner.first->second];
+				shadowRanges.push_back({ &m, shared.baseVertex, shared.firstIndex, false });
+			}
+		}
+	}
+	sizeSvb = sizeof(aiVector3D) * baseVertex;
+	sizeSeb = sizeof(unsigned int) * firstIndex;
 }
 
 void MeshMasher::loadMaterial(const aiMaterial* aiMat, Material& meshMat) {
 	aiString aistr;
-	if (aiMat->Get(AI_MATKEY_BLEND_FUNC, aistr) == aiReturn_SUCCESS && aistr.C_Str() == "BLEND") {
+	aiColor4D color;
+	if (aiMat->Get(AI_MATKEY_COLOR_DIFFUSE, color) == aiReturn_SUCCESS) {
+		meshMat.color[0] = color.r;
+		meshMat.color[1] = color.g;
+		meshMat.color[2] = color.b;
+		meshMat.color[3] = color.a;
+	}
+
+	// blended when the material has an opacity below 1, an opacity texture, additive blending or is a gltf material with
+	// alphaMode BLEND (opacity then usually stays 1 and comes from the base color alpha). AI_MATKEY_BLEND_FUNC is an
+	// aiBlendMode, aiBlendMode_Default is set on plenty of opaque materials too so it alone does not make one blended
+	// the gltf key is spelled out, the header defining AI_MATKEY_GLTF_ALPHAMODE moved between assimp versions
+	float opacity = 1.f;
+	int blendMode = aiBlendMode_Default;
+	bool translucent = aiMat->Get(AI_MATKEY_OPACITY, opacity) == aiReturn_SUCCESS && opacity < 1.f;
+	bool alphaTexture = aiMat->GetTexture(aiTextureType_OPACITY, 0, &aistr) == aiReturn_SUCCESS;
+	bool additive = aiMat->Get(AI_MATKEY_BLEND_FUNC, blendMode) == aiReturn_SUCCESS && blendMode == aiBlendMode_Additive;
+	bool alphaBlend = aiMat->Get("$mat.gltf.alphaMode", 0, 0, aistr) == aiReturn_SUCCESS && strcmp(aistr.C_Str(), "BLEND") == 0;
+	if (translucent || alphaTexture || additive || alphaBlend) {
 		meshMat.type = MaterialType::Opa;
-		if (aiMat->GetTexture(aiTextureType_OPACITY, 0, &aistr) == aiReturn_SUCCESS) {
+		if (alphaTexture) {
 			meshMat.useAlphaTex = true;
 			meshMat.useDiffuseAlpha = false;
 			loadTexture(meshMat, aiMat, aiTextureType_OPACITY, STBI_rgb);
+			loadTexture(meshMat, aiMat, aiTextureType_DIFFUSE, STBI_rgb);
 		}
-		else if (aiMat->Get(AI_MATKEY_OPACITY, meshMat.opacity) == aiReturn_SUCCESS && meshMat.opacity != 1.f)
+		else if (translucent) {
+			meshMat.opacity = opacity;
 			meshMat.useDiffuseAlpha = false;
-		else {
 			loadTexture(meshMat, aiMat, aiTextureType_DIFFUSE, STBI_rgb);
 		}
+		else
+			loadTexture(meshMat, aiMat, aiTextureType_DIFFUSE, STBI_rgb_alpha);				// opacity from the diffuse alpha
 	}
 	else {
 		meshMat.type = MaterialType::Tex;
+		meshMat.useDiffuseAlpha = false;
 		loadTexture(meshMat, aiMat, aiTextureType_DIFFUSE, STBI_rgb);
 		loadTexture(meshMat, aiMat, aiTextureType_NORMALS, STBI_rgb);
 		loadTexture(meshMat, aiMat, aiTextureType_UNKNOWN, STBI_rgb);
@@ -142,237 +829,802 @@ void MeshMasher::loadMaterial(const aiMaterial* aiMat, Material& meshMat) {
 
 void MeshMasher::loadTexture(Material& mat, const aiMaterial* aiMat, const aiTextureType textureType, const int stbVersion) {
 	aiString aistr;
-	if (aiMat->GetTexture(textureType, 0, &aistr) == aiReturn_SUCCESS) {
-		mat.textureNames[textureType] = aistr.C_Str();
+	if (aiMat->GetTexture(textureType, 0, &aistr) != aiReturn_SUCCESS)
+		return;
+	std::string name = aistr.C_Str();
+	mat.textureNames[textureType] = name;
 
-		if (textures.find(aistr.C_Str()) == textures.end()) {
-			Texture& texture = textures[aistr.C_Str()];
-			texture.type = textureType;
-			texture.name = aistr.C_Str();
-			texture.rgbType = stbVersion;
-			texture.data = stbi_load(("input/" + std::string(aistr.C_Str())).c_str(), &texture.width, &texture.height, &texture.nrChannels, stbVersion);
-		
-			if (texture.data == nullptr)
-				std::cerr << "Error: Texture of type " << textureType << " at location " << ("input" + std::string(aistr.C_Str())) << " not found." << std::endl;
-		}
+	// textures are shared by name over the materials loaded on every worker. one needed with alpha after it was decoded
+	// without is decoded again with 4 channels, so a MaterialDiffuseAlpha record never points at an rgb entry
+	{
+		std::lock_guard<std::mutex> lock(textureMutex);
+		auto cached = textures.find(name);
+		if (cached != textures.end() && cached->second.rgbType >= stbVersion)
+			return;
+	}
+
+	Texture texture;
+	texture.type = textureType;
+	texture.name = name;
+	texture.rgbType = stbVersion;
+	texture.data = stbi_load(("input/" + name).c_str(), &texture.width, &texture.height, &texture.nrChannels, stbVersion);
+	if (texture.data == nullptr)
+		std::cerr << "Error: Texture of type " << textureType << " at location " << ("input/" + name) << " not found." << std::endl;
+
+	std::lock_guard<std::mutex> lock(textureMutex);
+	auto cached = textures.find(name);
+	if (cached == textures.end())
+		textures.emplace(name, texture);
+	else if (cached->second.rgbType < stbVersion) {
+		stbi_image_free(cached->second.data);
+		cached->second = texture;
 	}
+	else
+		stbi_image_free(texture.data);															// decoded by another worker meanwhile
 }
 
-void MeshMasher::loadMesh(const aiMesh* aimesh, Mesh& mesh) {
-	mesh.materialIndex = aimesh->mMaterialIndex;
+size_t MeshMasher::estimateMaterialCost(const aiMaterial* aiMat) const {
+	// loading a material is decoding its textures, so the cost is their pixel count read from the image headers only
+	size_t pixels = 0;
+	for (auto textureType : { aiTextureType_DIFFUSE, aiTextureType_NORMALS, aiTextureType_UNKNOWN, aiTextureType_EMISSIVE, aiTextureType_OPACITY }) {
+		aiString aistr;
+		int width = 0, height = 0, channels = 0;
+		if (aiMat->GetTexture(textureType, 0, &aistr) == aiReturn_SUCCESS && stbi_info(("input/" + std::string(aistr.C_Str())).c_str(), &width, &height, &channels))
+			pixels += static_cast<size_t>(width) * height;
+	}
+	return pixels;
+}
 
-	if (settings.useMeshOptimizer) {
-		// run through meshoptimizer
-		// each vertex v/t/n with size float * (3 + 2 + 3) 
-		std::vector<Vertex> unindexedVertices;
-		unindexedVertices.reserve(aimesh->mNumVertices * 8);
-		for (unsigned int v = 0; v < aimesh->mNumVertices; v++) {
-			unindexedVertices.emplace_back(aimesh->mVertices[v], aiVector2D(aimesh->mTextureCoords[0][v].x, aimesh->mTextureCoords[0][v].y), aimesh->mNormals[v]);
-		}
+void MeshMasher::optimizeVertexCache(unsigned int* indices, size_t indexCount, size_t vertexCount) const {
+	// in place, meshoptimizer copies the input when destination == indices
+	switch (settings.optLevel) {
+	case OptLevel::Fast:
+		meshopt_optimizeVertexCacheFifo(indices, indices, indexCount, vertexCount, 16);
+		break;
+	case OptLevel::Strip:
+		meshopt_optimizeVertexCacheStrip(indices, indices, indexCount, vertexCount);
+		break;
+	default:
+		meshopt_optimizeVertexCache(indices, indices, indexCount, vertexCount);
+	}
+}
+
+void MeshMasher::collectInstances(const aiNode* node, const aiMatrix4x4& parentTransform, std::vector<std::vector<aiMatrix4x4>>& meshInstances) const {
+	aiMatrix4x4 transform = parentTransform * node->mTransformation;
+	for (unsigned int i = 0; i < node->mNumMeshes; i++)
+		meshInstances[node->mMeshes[i]].push_back(transform);
+	for (unsigned int i = 0; i < node->mNumChildren; i++)
+		collectInstances(node->mChildren[i], transform, meshInstances);
+}
+
+unsigned int MeshMasher::getNumChunks(const aiMesh* aimesh) const {
+	// chunks only pay off when there is meshoptimizer work to spread over the workers
+	if (!settings.useMeshOptimizer || settings.chunkTriangles == 0 || aimesh->mNumFaces <= settings.chunkTriangles)
+		return 1;
+	return (aimesh->mNumFaces + settings.chunkTriangles - 1) / settings.chunkTriangles;
+}
+
+void MeshMasher::planIndexRanges(const std::vector<std::pair<const aiMesh*, Mesh*>>& modelMeshes) {
+	// final range of every mesh in the index arena of its material type by prefix sum, each arena is then sized once
+	std::map<MaterialType, size_t> ends;
+	for (auto& a : arenas)
+		ends[a.first] = a.second.indexEnd();
+	for (auto& m : modelMeshes) {
+		Mesh* mesh = m.second;
+		mesh->firstIndex = static_cast<unsigned int>(ends[mesh->matType]);
+		ends[mesh->matType] += mesh->indexCount;
+	}
+	for (auto& e : ends)
+		arenas[e.first].indices.resize(e.second - arenas[e.first].flushedIndices);
+}
 
-		std::vector<unsigned int> srcIndices;
-		srcIndices.reserve(aimesh->mNumFaces * 3);
-		for (unsigned int f = 0; f < aimesh->mNumFaces; f++) {
-			srcIndices.emplace_back(aimesh->mFaces[f].mIndices[0]);
-			srcIndices.emplace_back(aimesh->mFaces[f].mIndices[1]);
-			srcIndices.emplace_back(aimesh->mFaces[f].mIndices[2]);
+void MeshMasher::planVertexRanges(const std::vector<std::pair<const aiMesh*, Mesh*>>& modelMeshes) {
+	// same as planIndexRanges, vertexCount is the remapped count when meshoptimizer is used
+	std::map<MaterialType, size_t> ends;
+	for (auto& a : arenas)
+		ends[a.first] = a.second.vertexEnd();
+	for (auto& m : modelMeshes) {
+		Mesh* mesh = m.second;
+		mesh->baseVertex = static_cast<unsigned int>(ends[mesh->matType]);
+		ends[mesh->matType] += mesh->vertexCount;
+	}
+	for (auto& e : ends)
+		arenas[e.first].vertices.resize(e.second - arenas[e.first].flushedVertices);
+}
+
+void MeshMasher::batchMeshes(std::vector<std::pair<const aiMesh*, Mesh*>>& modelMeshes) {
+	// small records of the same material type, material and single instance transform are grouped, the first record of a group becomes the merged draw
+	std::vector<std::vector<size_t>> groups;
+	std::vector<int> groupOf(modelMeshes.size(), -1);
+	for (size_t i = 0; i < modelMeshes.size(); i++) {
+		const Mesh& mesh = *modelMeshes[i].second;
+		if (mesh.isChunk || mesh.instanceCount != 1 || mesh.indexCount == 0 || mesh.indexCount / 3 >= settings.batchTriangles)
+			continue;
+
+		for (size_t g = 0; g < groups.size() && groupOf[i] < 0; g++) {
+			const Mesh& first = *modelMeshes[groups[g][0]].second;
+			if (first.matType == mesh.matType && first.materialIndex == mesh.materialIndex &&
+				memcmp(&instanceTransforms[first.firstInstance], &instanceTransforms[mesh.firstInstance], sizeof(aiMatrix4x4)) == 0)
+				groupOf[i] = static_cast<int>(g);
+		}
+		if (groupOf[i] < 0) {
+			groupOf[i] = static_cast<int>(groups.size());
+			groups.emplace_back();
 		}
+		groups[groupOf[i]].push_back(i);
+	}
 
-		mesh.indices.resize(srcIndices.size());
-		mesh.vertices.resize(unindexedVertices.size());
+	size_t numMerged = 0;
+	for (auto& g : groups)
+		numMerged += g.size() > 1 ? g.size() : 0;
+	if (numMerged == 0)
+		return;
 
-		//meshoptimizer
-		size_t sizeVertex = sizeof(float) * 8;
-		std::vector<unsigned int> remap(srcIndices.size());
-		auto vertexCount = meshopt_generateVertexRemap(&remap[0], &srcIndices[0], srcIndices.size(), &unindexedVertices[0], srcIndices.size(), sizeVertex);
-		meshopt_remapIndexBuffer(&mesh.indices[0], &srcIndices[0], srcIndices.size(), &remap[0]);
-		meshopt_remapVertexBuffer(&mesh.vertices[0], &unindexedVertices[0], srcIndices.size(), sizeVertex, &remap[0]);
-		meshopt_optimizeVertexCache(&mesh.indices[0], &mesh.indices[0], mesh.indices.size(), vertexCount);
-		meshopt_optimizeOverdraw(&mesh.indices[0], &mesh.indices[0], mesh.indices.size(), &mesh.vertices[0].pos.x, vertexCount, sizeVertex, 1.05f);
-		meshopt_optimizeVertexFetch(&mesh.vertices[0], &mesh.indices[0], mesh.indices.size(), &mesh.vertices[0], vertexCount, sizeVertex);
+	// rebuild the tail of this model in every arena from a copy of it, single records are copied as they are and the
+	// members of a group are appended one after another with their indices rebased into the merged vertex range
+	std::map<MaterialType, std::pair<size_t, size_t>> starts;								// first vertex / index of this model per arena
+	std::map<MaterialType, size_t> firstRecords;												// first record of this model in "meshes"
+	for (auto& m : modelMeshes) {
+		Mesh& mesh = *m.second;
+		size_t record = &mesh - meshes[mesh.matType].data();
+		if (starts.find(mesh.matType) == starts.end()) {
+			starts[mesh.matType] = { mesh.baseVertex, mesh.firstIndex };
+			firstRecords[mesh.matType] = record;
+		}
+		firstRecords[mesh.matType] = std::min(firstRecords[mesh.matType], record);
 	}
-	else {
-		mesh.vertices.reserve(aimesh->mNumVertices * 8);
-		for (unsigned int v = 0; v < aimesh->mNumVertices; v++) {
-			mesh.vertices.emplace_back(aimesh->mVertices[v], aiVector2D(aimesh->mTextureCoords[0][v].x, aimesh->mTextureCoords[0][v].y), aimesh->mNormals[v]);
+	std::map<MaterialType, GeometryArena> tails;
+	for (auto& s : starts) {
+		GeometryArena& arena = arenas[s.first];
+		tails[s.first].vertices.assign(arena.vertexAt(s.second.first), arena.vertexAt(arena.vertexEnd()));
+		tails[s.first].indices.assign(arena.indexAt(s.second.second), arena.indexAt(arena.indexEnd()));
+		arena.vertices.resize(s.second.first - arena.flushedVertices);
+		arena.indices.resize(s.second.second - arena.flushedIndices);
+	}
+
+	std::set<Mesh*> removed, batched;
+	for (size_t i = 0; i < modelMeshes.size(); i++) {
+		Mesh& mesh = *modelMeshes[i].second;
+		bool inGroup = groupOf[i] >= 0 && groups[groupOf[i]].size() > 1;
+		if (inGroup && groups[groupOf[i]][0] != i) {
+			removed.insert(&mesh);
+			continue;
 		}
 
-		mesh.indices.reserve(aimesh->mNumFaces * 3);
-		for (unsigned int f = 0; f < aimesh->mNumFaces; f++) {
-			mesh.indices.emplace_back(aimesh->mFaces[f].mIndices[0]);
-			mesh.indices.emplace_back(aimesh->mFaces[f].mIndices[1]);
-			mesh.indices.emplace_back(aimesh->mFaces[f].mIndices[2]);
+		GeometryArena& arena = arenas[mesh.matType];
+		const GeometryArena& tail = tails[mesh.matType];
+		auto start = starts[mesh.matType];
+		size_t baseVertex = arena.vertexEnd(), firstIndex = arena.indexEnd();
+		for (size_t j : inGroup ? groups[groupOf[i]] : std::vector<size_t>{ i }) {
+			const Mesh& member = *modelMeshes[j].second;
+			auto vertexOffset = static_cast<unsigned int>(arena.vertexEnd() - baseVertex);
+			auto srcVertices = tail.vertices.begin() + (member.baseVertex - start.first);
+			auto srcIndices = tail.indices.begin() + (member.firstIndex - start.second);
+			arena.vertices.insert(arena.vertices.end(), srcVertices, srcVertices + member.vertexCount);
+			for (auto it = srcIndices; it != srcIndices + member.indexCount; it++)
+				arena.indices.push_back(*it + vertexOffset);
+			if (j != i)
+				mesh.analysisBefore.add(member.analysisBefore);
 		}
+		mesh.baseVertex = static_cast<unsigned int>(baseVertex);
+		mesh.firstIndex = static_cast<unsigned int>(firstIndex);
+		mesh.vertexCount = static_cast<unsigned int>(arena.vertexEnd() - baseVertex);
+		mesh.indexCount = static_cast<unsigned int>(arena.indexEnd() - firstIndex);
+		if (inGroup)
+			batched.insert(&mesh);
+	}
+
+	// drop the merged away records, the records of this model are the tail of "meshes" so only that part is compacted
+	std::map<Mesh*, Mesh*> moved;
+	for (auto& f : firstRecords) {
+		auto& records = meshes[f.first];
+		size_t w = f.second;
+		for (size_t r = f.second; r < records.size(); r++) {
+			if (removed.count(&records[r]) != 0)
+				continue;
+			if (w != r)
+				records[w] = std::move(records[r]);
+			moved[&records[r]] = &records[w];
+			w++;
+		}
+		records.resize(w);
+	}
+	std::vector<std::pair<const aiMesh*, Mesh*>> keptMeshes;
+	for (auto& m : modelMeshes) {
+		if (removed.count(m.second) == 0)
+			keptMeshes.emplace_back(m.first, moved[m.second]);
 	}
-	
+	modelMeshes.swap(keptMeshes);
+
+	std::vector<std::pair<size_t, Command*>> tasks;
+	for (auto* mesh : batched)
+		tasks.emplace_back(moved[mesh]->indexCount, new CMesh(this, &MeshMasher::finishBatch, *moved[mesh]));
+	runPass(tasks);
+
+	batchedMeshCount += numMerged;
+	batchCount += batched.size();
 }
 
-void MeshMasher::writeLoaderData() {
-	// write about meshes
-	std::ofstream ofile("output/dat.ldr", std::fstream::out | std::fstream::binary);
-	if (ofile.is_open()) {
-		unsigned int baseVertex = 0, firstIndex = 0;
-		
-		// write the size of data in raw bytes to be read from other files by loaders like size of dat.vbf / dat.ebf files
-		// also primCount of all the total number of meshes to be rendered
-		ofile << sizeVbf << " " << sizeEbf << " " << primCount << std::endl;
+void MeshMasher::dedupMeshes(const std::vector<std::pair<const aiMesh*, Mesh*>>& modelMeshes) {
+	// the ranges of this model are the tail of each arena, in modelMeshes order. walk them in that order and
+	// either point a record at an identical range that is already in place or move its range down to the write cursor.
+	// indices are relative to baseVertex so moving a range never touches the index values
+	std::map<MaterialType, std::pair<size_t, size_t>> cursors;								// vertex / index write cursor per arena
+	for (auto& m : modelMeshes) {
+		Mesh& mesh = *m.second;
+		if (cursors.find(mesh.matType) == cursors.end())
+			cursors[mesh.matType] = { mesh.baseVertex, mesh.firstIndex };
+	}
 
-		// opaque materials need to be last and this order must match in other writefunx()
-		std::vector<MaterialType> matTypes{ MaterialType::Tex, MaterialType::Opa };
-		for (auto it = matTypes.begin(); it != matTypes.end(); it++) {
-			for (auto& m : meshes[*it])
-			{
-				ofile << m.modelName << " "
-					<< m.materialIndex << " "
-					<< m.indices.size() << " "						//count
-					<< baseVertex << " "
-					<< firstIndex << " "
-					<< modelBaseInstances[m.modelName] << " "		//baseInstance
-					<< std::endl;
-				
-				//baseVertex += (m.vertices.size()) / 8;				//each vertex is 8 v/t/n
-				baseVertex += m.vertices.size();
-				firstIndex += m.indices.size();
+	for (auto& m : modelMeshes) {
+		Mesh& mesh = *m.second;
+		GeometryArena& arena = arenas.at(mesh.matType);
+		auto& cursor = cursors[mesh.matType];
+
+		// ranges already written by -st 1 can not be compared any more, only ranges still in the arena are shared
+		bool shared = false;
+		auto range = uniqueMeshes.equal_range(mesh.contentHash);
+		for (auto it = range.first; it != range.second && !shared; it++) {
+			const Mesh& other = meshes[it->second.first][it->second.second];
+			shared = it->second.first == mesh.matType && other.vertexCount == mesh.vertexCount && other.indexCount == mesh.indexCount &&
+				other.baseVertex >= arena.flushedVertices && other.firstIndex >= arena.flushedIndices &&
+				std::equal(arena.indexAt(other.firstIndex), arena.indexAt(other.firstIndex + other.indexCount), arena.indexAt(mesh.firstIndex)) &&
+				memcmp(arena.vertexAt(other.baseVertex), arena.vertexAt(mesh.baseVertex), sizeof(Vertex) * mesh.vertexCount) == 0;
+			if (shared) {
+				mesh.baseVertex = other.baseVertex;
+				mesh.firstIndex = other.firstIndex;
 			}
 		}
-		ofile.flush();
+		if (shared) {
+			dedupMeshCount++;
+			dedupBytes += sizeof(Vertex) * mesh.vertexCount + sizeof(unsigned int) * mesh.indexCount;
+			continue;
+		}
+
+		// the cursor never passes the range it moves so copying forward is safe
+		if (cursor.first != mesh.baseVertex)
+			std::copy(arena.vertexAt(mesh.baseVertex), arena.vertexAt(mesh.baseVertex + mesh.vertexCount), arena.vertexAt(cursor.first));
+		if (cursor.second != mesh.firstIndex)
+			std::copy(arena.indexAt(mesh.firstIndex), arena.indexAt(mesh.firstIndex + mesh.indexCount), arena.indexAt(cursor.second));
+		mesh.baseVertex = static_cast<unsigned int>(cursor.first);
+		mesh.firstIndex = static_cast<unsigned int>(cursor.second);
+		cursor.first += mesh.vertexCount;
+		cursor.second += mesh.indexCount;
+		uniqueMeshes.emplace(mesh.contentHash, std::make_pair(mesh.matType, static_cast<size_t>(&mesh - meshes[mesh.matType].data())));
 	}
-	else
-		std::cout << "Error: " << "ldr file failed on creation." << std::endl;
 
+	for (auto& c : cursors) {
+		arenas[c.first].vertices.resize(c.second.first - arenas[c.first].flushedVertices);
+		arenas[c.first].indices.resize(c.second.second - arenas[c.first].flushedIndices);
+	}
 }
 
-void MeshMasher::writeVBufferData() {
-	//write vertex buffer dat
-	std::ofstream ofile("output/dat.vbf", std::fstream::out | std::fstream::binary);
-	if (ofile.is_open()) {
-		size_t sizeVertices = 0;
+void MeshMasher::splitMesh(const aiMesh* aimesh, Mesh& firstChunk) {
+	// chunks of one mesh are consecutive records of the same material type so together they own one contiguous index range
+	// sorting the whole mesh spatially first makes every even slice of that range a spatially coherent chunk
+	unsigned int* indices = arenas.at(firstChunk.matType).indexAt(firstChunk.firstIndex);
+	unsigned int* faceIndices = getScratch().allocate<unsigned int>(aimesh->mNumFaces * 3);
+	flattenFaces(faceIndices, aimesh->mFaces, aimesh->mNumFaces);
+	meshopt_spatialSortTriangles(indices, faceIndices, aimesh->mNumFaces * 3, &aimesh->mVertices[0].x, aimesh->mNumVertices, sizeof(aiVector3D));
+}
 
-		// opaque materials need to be last and this order must match in other writefunx()
-		std::vector<MaterialType> matTypes{ MaterialType::Tex, MaterialType::Opa };
-		for (auto it = matTypes.begin(); it != matTypes.end(); it++) {
-			// primCount for indirect draw
-			primCount += meshes[*it].size();
-
-			for (auto& m : meshes[*it]){
-				sizeVertices = sizeof(Vertex) * m.vertices.size();
-				//sizeVertices = sizeof(float) * m.vertices.size();
-				ofile.write(reinterpret_cast<char*>(&m.vertices[0]), sizeVertices);
-				sizeVbf += sizeVertices;
-			}
+// rebase the indices of a chunk onto the vertices it references and point the v/t/n streams at a compact copy of them.
+// returns the assimp vertex of every local vertex, vertexCount is set to their number
+static unsigned int* compactChunk(const aiMesh* aimesh, unsigned int* indices, size_t indexCount, size_t& vertexCount, meshopt_Stream* streams) {
+	ScratchArena& scratch = getScratch();
+	unsigned int* localVertices = scratch.allocate<unsigned int>(indexCount);
+
+	// open addressing table from assimp vertex to local vertex, at most 2/3 full
+	unsigned int tableBits = 4;
+	while ((size_t(1) << tableBits) < indexCount + indexCount / 2)
+		tableBits++;
+	size_t tableMask = (size_t(1) << tableBits) - 1;
+	unsigned int* keys = scratch.allocate<unsigned int>(tableMask + 1);
+	unsigned int* values = scratch.allocate<unsigned int>(tableMask + 1);
+	std::fill(keys, keys + tableMask + 1, ~0u);
+
+	vertexCount = 0;
+	for (size_t i = 0; i < indexCount; i++) {
+		unsigned int v = indices[i];
+		size_t slot = (v * 2654435761u) >> (32 - tableBits);
+		while (keys[slot] != ~0u && keys[slot] != v)
+			slot = (slot + 1) & tableMask;
+		if (keys[slot] == ~0u) {
+			keys[slot] = v;
+			values[slot] = static_cast<unsigned int>(vertexCount);
+			localVertices[vertexCount++] = v;
 		}
-		ofile.flush();
+		indices[i] = values[slot];
 	}
-	else
-		std::cout << "Error: " << "vbf file failed on creation." << std::endl;
+	scratch.deallocate(values);
+	scratch.deallocate(keys);
 
+	// gather the v/t/n of the local vertices, same element sizes as the streams they replace
+	float* positions = scratch.allocate<float>(vertexCount * 3);
+	float* texCoords = scratch.allocate<float>(vertexCount * 2);
+	float* normals = scratch.allocate<float>(vertexCount * 3);
+	for (size_t i = 0; i < vertexCount; i++) {
+		const aiVector3D& p = aimesh->mVertices[localVertices[i]];
+		const aiVector3D& t = aimesh->mTextureCoords[0][localVertices[i]];
+		const aiVector3D& n = aimesh->mNormals[localVertices[i]];
+		positions[i * 3 + 0] = p.x;
+		positions[i * 3 + 1] = p.y;
+		positions[i * 3 + 2] = p.z;
+		texCoords[i * 2 + 0] = t.x;
+		texCoords[i * 2 + 1] = t.y;
+		normals[i * 3 + 0] = n.x;
+		normals[i * 3 + 1] = n.y;
+		normals[i * 3 + 2] = n.z;
+	}
+	streams[0] = { positions, sizeof(float) * 3, sizeof(float) * 3 };
+	streams[1] = { texCoords, sizeof(float) * 2, sizeof(float) * 2 };
+	streams[2] = { normals, sizeof(float) * 3, sizeof(float) * 3 };
+	return localVertices;
 }
 
-void MeshMasher::writeEBufferData() {
-	//write elements buffer dat
-	std::ofstream ofile("output/dat.ebf", std::fstream::out | std::fstream::binary);
-	if (ofile.is_open()) {
-		size_t sizeEle = 0;
+void MeshMasher::remapMesh(const aiMesh* aimesh, Mesh& mesh) {
+	// run through meshoptimizer
+	// indices are flattened straight into their final range in the arena and remapped in place
+	unsigned int* indices = arenas.at(mesh.matType).indexAt(mesh.firstIndex);
+	if (!mesh.isChunk)
+		flattenFaces(indices, aimesh->mFaces, aimesh->mNumFaces);
 
-		// opaque materials need to be last and this order must match in other writefunx()
-		std::vector<MaterialType> matTypes{ MaterialType::Tex, MaterialType::Opa };
-		for (auto it = matTypes.begin(); it != matTypes.end(); it++) {
-			for (auto& m : meshes[*it])
-			{
-				sizeEle = sizeof(unsigned int) * m.indices.size();
-				ofile.write(reinterpret_cast<char*>(m.indices.data()), sizeEle);
-				sizeEbf += sizeEle;
-			}
-		}
-		ofile.flush();
-	} 
-	else 
-		std::cout << "Error: " << "ebf file failed on creation." << std::endl;
-}
-
-void MeshMasher::writeMaterialData() {
-	// NOTE: for now only exporting albedo texture. will export other texture and material types later
-	std::ofstream ofile("output/dat.mtr", std::fstream::out | std::fstream::binary);
-	if (ofile.is_open()) {
-		for (auto it = materials.begin(); it != materials.end(); it++) {
-			// write num materials for each model type first
-			ofile << it->first << " " << it->second.size() << std::endl;
-			
-			//write material properties, but writing albedo texture only for now
-			for (auto itMat = it->second.begin(); itMat != it->second.end(); itMat++) {
-				ofile << itMat->textureNames[aiTextureType_DIFFUSE] << std::endl;
+	// dedup directly over the assimp v/t/n streams, texcoords are aiVector3D so only the first 2 floats are compared
+	ScratchArena& scratch = getScratch();
+	size_t vertexCount = aimesh->mNumVertices;
+	meshopt_Stream streams[] = {
+		{ aimesh->mVertices, sizeof(aiVector3D), sizeof(aiVector3D) },
+		{ aimesh->mTextureCoords[0], sizeof(aiVector2D), sizeof(aiVector3D) },
+		{ aimesh->mNormals, sizeof(aiVector3D), sizeof(aiVector3D) }
+	};
+
+	// a chunk only references part of the vertices. they are compacted into local streams first, with the indices rebased
+	// onto them, so the remap and meshoptimizer's hash table scale with the chunk and not with the whole mesh
+	unsigned int* localVertices = nullptr;																// local vertex -> assimp vertex
+	if (mesh.isChunk)
+		localVertices = compactChunk(aimesh, indices, mesh.indexCount, vertexCount, streams);
+
+	unsigned int* remap = scratch.allocate<unsigned int>(vertexCount);
+	mesh.vertexCount = static_cast<unsigned int>(meshopt_generateVertexRemapMulti(remap, indices, mesh.indexCount, vertexCount, streams, sizeof(streams) / sizeof(streams[0])));
+
+	// remap the indices in place and keep the source of every remapped vertex so loadMesh can gather them
+	mesh.sourceVertices.resize(mesh.vertexCount);
+	for (unsigned int i = 0; i < mesh.indexCount; i++) {
+		unsigned int v = indices[i];
+		mesh.sourceVertices[remap[v]] = localVertices ? localVertices[v] : v;
+		indices[i] = remap[v];
+	}
+}
+
+void MeshMasher::loadMesh(const aiMesh* aimesh, Mesh& mesh) {
+	GeometryArena& arena = arenas.at(mesh.matType);
+	Vertex* vertices = arena.vertexAt(mesh.baseVertex);
+	unsigned int* indices = arena.indexAt(mesh.firstIndex);
+
+	if (settings.useMeshOptimizer) {
+		// indices were remapped by remapMesh, each vertex v/t/n with size float * (3 + 2 + 3) is interleaved once, straight into its slot in the arena
+		gatherVertices(vertices, aimesh->mVertices, aimesh->mTextureCoords[0], aimesh->mNormals, aimesh->mNumVertices, mesh.sourceVertices.data(), mesh.vertexCount);
+		std::vector<unsigned int>().swap(mesh.sourceVertices);
+		if (settings.writeReport)
+			mesh.analysisBefore = analyzeMesh(vertices, indices, mesh);										// deduped, still in the order assimp delivered
+
+		//meshoptimizer, the amount of work depends on settings.optLevel
+		size_t sizeVertex = sizeof(float) * 8;
+		auto start = std::chrono::steady_clock::now();
+		optimizeVertexCache(indices, mesh.indexCount, mesh.vertexCount);
+
+		// overdraw is about as expensive as the cache pass, drop it when what is left of the budget would not cover another one
+		// it only pays off on meshes big enough to cover each other on screen
+		bool overdraw = settings.optLevel != OptLevel::Fast && (settings.optLevel != OptLevel::Balanced || mesh.indexCount >= 3 * 256);
+		if (overdraw && settings.meshTimeBudget != 0) {
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			if (2.0 * ms > settings.meshTimeBudget) {
+				overdraw = false;
+				overdrawSkipped++;
 			}
 		}
+		if (overdraw)
+			meshopt_optimizeOverdraw(indices, indices, mesh.indexCount, &vertices[0].pos.x, mesh.vertexCount, sizeVertex, 1.05f);
+		meshopt_optimizeVertexFetch(vertices, indices, mesh.indexCount, vertices, mesh.vertexCount, sizeVertex);
+	}
+	else {
+		interleaveVertices(vertices, aimesh->mVertices, aimesh->mTextureCoords[0], aimesh->mNormals, aimesh->mNumVertices);
+		flattenFaces(indices, aimesh->mFaces, aimesh->mNumFaces);
+	}
+
+	computeBounds(vertices, mesh.vertexCount, mesh.bounds);
 
-		ofile.flush();
+	mesh.contentHash = hashGeometry(vertices, sizeof(Vertex) * mesh.vertexCount, hashGeometry(indices, sizeof(unsigned int) * mesh.indexCount, mesh.indexCount));
+
+	if (settings.writeReport) {
+		mesh.analysisAfter = analyzeMesh(vertices, indices, mesh);
+		if (!settings.useMeshOptimizer)
+			mesh.analysisBefore = mesh.analysisAfter;
 	}
-	else
-		std::cout << "Error: " << "mtr file failed on creation." << std::endl;
 
+	if (settings.writeShadowData)
+		loadShadowMesh(mesh);
 }
 
-void MeshMasher::writeTextureData() {
-	std::ofstream ofileRgb("output/dat.rgb", std::fstream::out | std::fstream::binary);				//store raw binary texture image data, GL_RGB interal format based name 
-	std::ofstream ofileTxr("output/dat.txr", std::fstream::out);									//store properties of the texture 
-	if (ofileTxr.is_open() && ofileRgb.is_open()) {
-		for (auto it = textures.begin(); it != textures.end(); it++) {
+void MeshMasher::finishBatch(Mesh& mesh) {
+	// the members were only concatenated, so the merged draw gets its own cache / fetch order and everything derived from the geometry
+	GeometryArena& arena = arenas.at(mesh.matType);
+	Vertex* vertices = arena.vertexAt(mesh.baseVertex);
+	unsigned int* indices = arena.indexAt(mesh.firstIndex);
 
-			// again for now only working with diffuse texture
-			if (it->second.type == aiTextureType_DIFFUSE) {
-				size_t sizeData = strlen(reinterpret_cast<char*>(it->second.data));
-				ofileTxr << it->first << " " << it->second.width << " " << it->second.height << " " << sizeData << std::endl;
-				ofileRgb.write(reinterpret_cast<char*>(it->second.data), sizeData);
-				stbi_image_free(it->second.data);
-			}
+	// with -mo 0 the concatenated members are drawn as they are
+	if (settings.useMeshOptimizer) {
+		optimizeVertexCache(indices, mesh.indexCount, mesh.vertexCount);
+		meshopt_optimizeVertexFetch(vertices, indices, mesh.indexCount, vertices, mesh.vertexCount, sizeof(Vertex));
+	}
+	computeBounds(vertices, mesh.vertexCount, mesh.bounds);
+	mesh.contentHash = hashGeometry(vertices, sizeof(Vertex) * mesh.vertexCount, hashGeometry(indices, sizeof(unsigned int) * mesh.indexCount, mesh.indexCount));
+
+	if (settings.writeReport)
+		mesh.analysisAfter = analyzeMesh(vertices, indices, mesh);
+	if (settings.writeShadowData)
+		loadShadowMesh(mesh);
+}
+
+MeshAnalysis MeshMasher::analyzeMesh(const Vertex* vertices, const unsigned int* indices, const Mesh& mesh) const {
+	MeshAnalysis analysis;
+	if (mesh.indexCount == 0)
+		return analysis;
+
+	auto cache = meshopt_analyzeVertexCache(indices, mesh.indexCount, mesh.vertexCount, 16, 0, 0);
+	auto overdraw = meshopt_analyzeOverdraw(indices, mesh.indexCount, &vertices[0].pos.x, mesh.vertexCount, sizeof(Vertex));
+	auto fetch = meshopt_analyzeVertexFetch(indices, mesh.indexCount, mesh.vertexCount, sizeof(Vertex));
+
+	analysis.triangles = mesh.indexCount / 3;
+	analysis.vertices = mesh.vertexCount;
+	analysis.vertexBytes = sizeof(Vertex) * mesh.vertexCount;
+	analysis.verticesTransformed = cache.vertices_transformed;
+	analysis.pixelsCovered = overdraw.pixels_covered;
+	analysis.pixelsShaded = overdraw.pixels_shaded;
+	analysis.bytesFetched = fetch.bytes_fetched;
+	return analysis;
+}
+
+void MeshMasher::simplifyMesh(Mesh& mesh) {
+	// every level keeps ~70% of the triangles of the one before so the budget can be met closely,
+	// all levels are simplified from the full detail indices so errors do not pile up
+	GeometryArena& arena = arenas.at(mesh.matType);
+	const Vertex* vertices = arena.vertexAt(mesh.baseVertex);
+	const unsigned int* indices = arena.indexAt(mesh.firstIndex);
+
+	// chunks keep their borders so neighbouring chunks still meet without cracks
+	unsigned int options = mesh.isChunk ? meshopt_SimplifyLockBorder : 0;
+	float scale = meshopt_simplifyScale(&vertices[0].pos.x, mesh.vertexCount, sizeof(Vertex));
+	unsigned int* simplified = getScratch().allocate<unsigned int>(mesh.indexCount);
+	size_t previousCount = mesh.indexCount;
+	float previousError = 0.f;
+	for (size_t target = mesh.indexCount * 7 / 10; target >= 3 * 8; target = target * 7 / 10) {
+		float error = 0.f;
+		size_t count = meshopt_simplify(simplified, indices, mesh.indexCount, &vertices[0].pos.x, mesh.vertexCount, sizeof(Vertex), target, 1.f, options, &error);
+		if (count >= previousCount)																// stuck, coarser targets won't get any further
+			break;
+
+		optimizeVertexCache(simplified, count, mesh.vertexCount);
+		MeshLod& lod = mesh.lods.emplace_back();
+		lod.indices.assign(simplified, simplified + count);
+		lod.error = std::max(error * scale, previousError);
+		previousCount = count;
+		previousError = lod.error;
+	}
+}
+
+void MeshMasher::refreshBudgetMesh(Mesh& mesh) {
+	if (settings.writeReport) {
+		GeometryArena& arena = arenas.at(mesh.matType);
+		mesh.analysisAfter = analyzeMesh(arena.vertexAt(mesh.baseVertex), arena.indexAt(mesh.firstIndex), mesh);
+	}
+	if (settings.writeShadowData)
+		loadShadowMesh(mesh);
+}
+
+void MeshMasher::loadShadowMesh(Mesh& mesh) {
+	if (mesh.indexCount == 0)
+		return;
+
+	GeometryArena& arena = arenas.at(mesh.matType);
+	const Vertex* vertices = arena.vertexAt(mesh.baseVertex);
+	const unsigned int* indices = arena.indexAt(mesh.firstIndex);
+
+	// position only equality so vertices split by uv/normal seams collapse into the first vertex with the same position
+	mesh.shadowIndices.resize(mesh.indexCount);
+	meshopt_generateShadowIndexBuffer(&mesh.shadowIndices[0], indices, mesh.indexCount, &vertices[0].pos.x, mesh.vertexCount, sizeof(aiVector3D), sizeof(Vertex));
+	optimizeVertexCache(&mesh.shadowIndices[0], mesh.shadowIndices.size(), mesh.vertexCount);
+
+	// compact the referenced positions into their own stream in fetch order
+	unsigned int* remap = getScratch().allocate<unsigned int>(mesh.vertexCount);
+	auto shadowVertexCount = meshopt_optimizeVertexFetchRemap(remap, &mesh.shadowIndices[0], mesh.shadowIndices.size(), mesh.vertexCount);
+	meshopt_remapIndexBuffer(&mesh.shadowIndices[0], &mesh.shadowIndices[0], mesh.shadowIndices.size(), remap);
+
+	mesh.shadowVertices.resize(shadowVertexCount);
+	for (size_t v = 0; v < mesh.vertexCount; v++) {
+		if (remap[v] != ~0u)
+			mesh.shadowVertices[remap[v]] = vertices[v].pos;
+	}
+}
+
+void MeshMasher::writeLoaderData(std::ostream& ofile) {
+	// write about meshes, one indirect command per draw record plus the side tables
+	std::vector<DrawElementsIndirectCommand> commands;
+	std::vector<DrawInfo> drawInfos;
+	std::vector<DrawBounds> bounds;
+	unsigned int vertexOffset = 0, indexOffset = 0;										// start of each arena in dat.vbf / dat.ebf
+
+	// opaque materials need to be last and this order must match in other writefunx()
+	std::vector<MaterialType> matTypes{ MaterialType::Tex, MaterialType::Opa };
+	for (auto it = matTypes.begin(); it != matTypes.end(); it++) {
+		for (auto& m : meshes.at(*it)) {
+			commands.push_back({ m.indexCount, m.instanceCount, indexOffset + m.firstIndex, static_cast<int32_t>(vertexOffset + m.baseVertex), m.firstInstance });
+			drawInfos.push_back({ materialIds.at(m.modelName)[m.materialIndex], modelBaseInstances.at(m.modelName) });
+			bounds.push_back({ { m.bounds.center.x, m.bounds.center.y, m.bounds.center.z }, m.bounds.radius,
+				{ m.bounds.min.x, m.bounds.min.y, m.bounds.min.z }, 0.f, { m.bounds.max.x, m.bounds.max.y, m.bounds.max.z }, 0.f });
 		}
 
-		ofileTxr.flush();
-		ofileRgb.flush();
+		vertexOffset += static_cast<unsigned int>(arenas[*it].vertexEnd());
+		indexOffset += static_cast<unsigned int>(arenas[*it].indexEnd());
 	}
-	else
-		std::cerr << "Error: " << "txr & img file failed on creation." << std::endl;
-}
-
-void DisplayInvalidArgsMsg() {
-	std::cerr << "Error: Invalid arguments. Arguments should be in the following format:\n";
-	std::cerr << "meshmasher.exe -wt <numWorkerThreads> -ptv <bool 0 / 1> -mo <bool 0 / 1>\n";
-	std::cerr << "-wt = number of worker threads (1 to 6, default 2)\n";
-	std::cerr << "-ptv = pre transform vertices (aiProcess_PreTransformVertices flag, default 1)\n";
-	std::cerr << "-mo = Use meshoptimizer lib (0 / 1, default 1)\n";
-}
-
-int main(int argc, char** argv) {
-	// args = meshmasher.exe -wt <numWorkerThreads> -ptv <bool 0, 1> -mo <bool 0, 1>
-	Settings settings;
-	if (argc == 7) {
-		if ((strcmp(argv[1], "-wt") == 0) &&
-			(std::stoi(argv[2]) >= 1 && std::stoi(argv[2]) <= 6) &&
-			(strcmp(argv[3],"-ptv") == 0) &&
-			(std::stoi(argv[4]) <= 1) &&
-			(strcmp(argv[5], "-mo") == 0) &&
-			(std::stoi(argv[6]) <= 1)) {
-			settings.numWorkerThreads = std::stoi(argv[2]);
-			settings.preTransformVertices = std::stoi(argv[4]);
-			settings.useMeshOptimizer = std::stoi(argv[6]);
-		}
-		else  {
-			DisplayInvalidArgsMsg();
-			return 1;
-		} 
-	}
-	else if (argc != 1) {
-		DisplayInvalidArgsMsg();
-		return 1;
+
+	writeLoaderFile(ofile, sizeVbf, sizeEbf, commands, drawInfos, &bounds);
+}
+
+void MeshMasher::writeLoaderFile(std::ostream& ofile, uint64_t sizeVertices, uint64_t sizeIndices, const std::vector<DrawElementsIndirectCommand>& commands,
+	const std::vector<DrawInfo>& drawInfos, const std::vector<DrawBounds>* bounds) {
+	// model names ordered by model id (the baseInstance of the text format)
+	std::vector<std::string> names(currBaseInstance);
+	for (auto& m : modelBaseInstances)
+		names[m.second] = m.first;
+	std::vector<ModelName> nameEntries;
+	uint32_t nameOffset = static_cast<uint32_t>(sizeof(ModelName) * names.size());
+	for (auto& name : names) {
+		nameEntries.push_back({ nameOffset, static_cast<uint32_t>(name.size()) });
+		nameOffset += static_cast<uint32_t>(name.size());
+	}
+
+	auto align = [](uint64_t offset) { return (offset + 15) & ~uint64_t(15); };
+	LoaderHeader header = { { 'M', 'M', 'L', 'D' }, LoaderVersion, sizeVertices, sizeIndices, static_cast<uint32_t>(commands.size()), static_cast<uint32_t>(names.size()) };
+	header.commandsOffset = align(sizeof(LoaderHeader));
+	header.drawInfoOffset = align(header.commandsOffset + sizeof(DrawElementsIndirectCommand) * commands.size());
+	uint64_t end = align(header.drawInfoOffset + sizeof(DrawInfo) * drawInfos.size());
+	header.boundsOffset = bounds != nullptr ? end : 0;
+	if (bounds != nullptr)
+		end = align(end + sizeof(DrawBounds) * bounds->size());
+	header.modelNamesOffset = end;
+
+	// sections are written in file order, padding up to the next offset. offsets are from the start of the
+	// loader data, which is not the start of the stream inside dat.mmc
+	const char zeros[16] = {};
+	uint64_t written = sizeof(LoaderHeader);
+	auto writeSection = [&](uint64_t offset, const void* data, size_t size) {
+		ofile.write(zeros, offset - written);
+		ofile.write(reinterpret_cast<const char*>(data), size);
+		written = offset + size;
+	};
+	ofile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	writeSection(header.commandsOffset, commands.data(), sizeof(DrawElementsIndirectCommand) * commands.size());
+	writeSection(header.drawInfoOffset, drawInfos.data(), sizeof(DrawInfo) * drawInfos.size());
+	if (bounds != nullptr)
+		writeSection(header.boundsOffset, bounds->data(), sizeof(DrawBounds) * bounds->size());
+	writeSection(header.modelNamesOffset, nameEntries.data(), sizeof(ModelName) * nameEntries.size());
+	for (auto& name : names)
+		ofile.write(name.data(), name.size());
+}
+
+void MeshMasher::writeVBufferData(std::ostream& ofile) {
+	//write vertex buffer dat
+	// opaque materials need to be last and this order must match in other writefunx()
+	// the whole arena of each material type is written at once
+	std::vector<MaterialType> matTypes{ MaterialType::Tex, MaterialType::Opa };
+	for (auto it = matTypes.begin(); it != matTypes.end(); it++)
+		ofile.write(reinterpret_cast<char*>(arenas[*it].vertices.data()), sizeof(Vertex) * arenas[*it].vertices.size());
+}
+
+void MeshMasher::writeEBufferData(std::ostream& ofile) {
+	//write elements buffer dat
+	// opaque materials need to be last and this order must match in other writefunx()
+	std::vector<MaterialType> matTypes{ MaterialType::Tex, MaterialType::Opa };
+	for (auto it = matTypes.begin(); it != matTypes.end(); it++)
+		ofile.write(reinterpret_cast<char*>(arenas[*it].indices.data()), sizeof(unsigned int) * arenas[*it].indices.size());
+}
+
+void MeshMasher::writeInstanceData(std::ostream& ofile) {
+	// column major 4x4 float matrices ready for a mat4 ssbo, instance i of a draw record is dat.ins[firstInstance + gl_InstanceID]
+	for (auto transform : instanceTransforms) {
+		transform.Transpose();
+		ofile.write(reinterpret_cast<char*>(&transform.a1), sizeof(float) * 16);
+	}
+}
+
+void MeshMasher::writeMaterialData(std::ostream& ofile) {
+	// the table built by planMaterials, records right after the header so they can be uploaded as they are
+	MaterialHeader header = { { 'M', 'M', 'M', 'T' }, MaterialVersion, static_cast<uint32_t>(materialTable.size()), sizeof(MaterialHeader) };
+	ofile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	ofile.write(reinterpret_cast<const char*>(materialTable.data()), sizeof(MaterialRecord) * materialTable.size());
+}
+
+void MeshMasher::writeTextureData(std::ostream& ofile) {
+	// the table built by planTextures, laid out like dat.ldr
+	auto align = [](uint64_t offset) { return (offset + 15) & ~uint64_t(15); };
+	TextureHeader header = { { 'M', 'M', 'T', 'X' }, TextureVersion, static_cast<uint32_t>(textureTable.size()), static_cast<uint32_t>(mipTable.size()), sizeRgb };
+	header.entriesOffset = align(sizeof(TextureHeader));
+	header.mipsOffset = align(header.entriesOffset + sizeof(TextureEntry) * textureTable.size());
+	header.namesOffset = align(header.mipsOffset + sizeof(MipDescriptor) * mipTable.size());
+
+	const char zeros[16] = {};
+	uint64_t written = sizeof(TextureHeader);
+	auto writeSection = [&](uint64_t offset, const void* data, size_t size) {
+		ofile.write(zeros, offset - written);
+		ofile.write(reinterpret_cast<const char*>(data), size);
+		written = offset + size;
+	};
+	ofile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	writeSection(header.entriesOffset, textureTable.data(), sizeof(TextureEntry) * textureTable.size());
+	writeSection(header.mipsOffset, mipTable.data(), sizeof(MipDescriptor) * mipTable.size());
+	ofile.write(zeros, header.namesOffset - written);
+	for (auto& t : textureIndices)
+		ofile.write(t.first.data(), t.first.size());
+}
+
+void MeshMasher::writeImageData(std::ostream& ofile) {
+	//store raw binary texture image data at the offsets of dat.txr. freed by writeOutput once every writer is done
+	const char zeros[16] = {};
+	uint64_t written = 0;
+	for (auto& t : textureIndices) {
+		const TextureEntry& entry = textureTable[t.second];
+		ofile.write(zeros, entry.offset - written);
+		ofile.write(reinterpret_cast<const char*>(textures.at(t.first).data), entry.size);
+		written = entry.offset + entry.size;
+	}
+}
+
+void MeshMasher::writeShadowLoaderData(std::ostream& ofile) {
+	// draw records matching dat.ldr one to one, pointing at the ranges planned by planShadowRanges
+	std::vector<DrawElementsIndirectCommand> commands;
+	std::vector<DrawInfo> drawInfos;
+	for (auto& r : shadowRanges) {
+		commands.push_back({ static_cast<uint32_t>(r.mesh->shadowIndices.size()), r.mesh->instanceCount, r.firstIndex, static_cast<int32_t>(r.baseVertex), r.mesh->firstInstance });
+		drawInfos.push_back({ materialIds.at(r.mesh->modelName)[r.mesh->materialIndex], modelBaseInstances.at(r.mesh->modelName) });
+	}
+
+	// same layout as dat.ldr without the bounds so loaders can reuse their parsing
+	writeLoaderFile(ofile, sizeSvb, sizeSeb, commands, drawInfos, nullptr);
+}
+
+void MeshMasher::writeShadowVBufferData(std::ostream& ofile) {
+	// position only vertex stream
+	for (auto& r : shadowRanges) {
+		if (r.owner)
+			ofile.write(reinterpret_cast<const char*>(r.mesh->shadowVertices.data()), sizeof(aiVector3D) * r.mesh->shadowVertices.size());
 	}
+}
 
-	std::cout << std::boolalpha << "-----****************-----\nMeshMasher Settings :-\nNum Worker Threads : " << settings.numWorkerThreads <<
-		"\nPre Transform Vertices : " << settings.preTransformVertices <<
-		"\nUse MeshOptimizer Lib : " << settings.useMeshOptimizer << "\n//chirag\n------****************------\n";
+void MeshMasher::writeShadowEBufferData(std::ostream& ofile) {
+	for (auto& r : shadowRanges) {
+		if (r.owner)
+			ofile.write(reinterpret_cast<const char*>(r.mesh->shadowIndices.data()), sizeof(unsigned int) * r.mesh->shadowIndices.size());
+	}
+}
 
-	MeshMasher masher(settings);
-	masher.run();	
-	return 0;
+void MeshMasher::writeFileRange(OutputFile& file, const FileRange& range) {
+	// errors are reported once per file when it is closed
+	file.write(range.offset, range.data, range.size);
 }
 
-//chirag 2023
+void MeshMasher::writeContainerData() {
+	// every output file as one section of dat.mmc, each starting on a page boundary. the header and the table of
+	// contents are written last, once the section sizes are known
+	std::ofstream ofile("output/dat.mmc", std::fstream::out | std::fstream::binary);
+	if (!ofile.is_open()) {
+		std::cout << "Error: " << "mmc file failed on creation." << std::endl;
+		return;
+	}
 
+	auto sections = getOutputSections();
+	ContainerHeader header = { { 'M', 'M', 'C', 'T' }, ContainerVersion, static_cast<uint32_t>(sections.size()), ContainerAlignment };
+	std::vector<ContainerSection> toc(sections.size());
+	ofile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	ofile.write(reinterpret_cast<const char*>(toc.data()), sizeof(ContainerSection) * toc.size());
+
+	const std::vector<char> zeros(ContainerAlignment);
+	uint64_t end = sizeof(ContainerHeader) + sizeof(ContainerSection) * toc.size();
+	for (size_t i = 0; i < sections.size(); i++) {
+		uint64_t offset = (end + ContainerAlignment - 1) & ~uint64_t(ContainerAlignment - 1);
+		ofile.write(zeros.data(), offset - end);
+		if (sections[i].writer != nullptr)
+			(this->*sections[i].writer)(ofile);
+		else {
+			for (auto& range : sections[i].ranges)
+				ofile.write(static_cast<const char*>(range.data), range.size);
+		}
+		end = static_cast<uint64_t>(static_cast<std::streamoff>(ofile.tellp()));
+
+		memcpy(toc[i].name, sections[i].name, std::min(strlen(sections[i].name), sizeof(toc[i].name)));
+		toc[i].offset = offset;
+		toc[i].size = end - offset;
+	}
+
+	header.fileSize = end;
+	ofile.seekp(0);
+	ofile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	ofile.write(reinterpret_cast<const char*>(toc.data()), sizeof(ContainerSection) * toc.size());
+	ofile.flush();
+	if (!ofile)
+		std::cout << "Error: " << "mmc file failed on write." << std::endl;
+	else
+		std::cout << "Container : output/dat.mmc, " << toc.size() << " sections, " << end << " bytes" << std::endl;
+}
+
+// meshes are numbered in draw order, the same order as the records in dat.ldr
+void MeshMasher::writeReportData() {
+	std::ofstream ofileJson("output/report.json", std::fstream::out);
+	std::ofstream ofileCsv("output/report.csv", std::fstream::out);
+	if (ofileJson.is_open() && ofileCsv.is_open()) {
+		const char* bucketNames[] = { "Tex", "Opa" };
+		std::vector<MaterialType> matTypes{ MaterialType::Tex, MaterialType::Opa };
+		std::map<std::string, std::pair<MeshAnalysis, MeshAnalysis>> models;
+		std::map<MaterialType, std::pair<MeshAnalysis, MeshAnalysis>> buckets;
+		std::pair<MeshAnalysis, MeshAnalysis> scene;
+
+		auto writeCsv = [&](const char* scope, const std::string& name, const std::string& bucket, const std::pair<MeshAnalysis, MeshAnalysis>& a) {
+			ofileCsv << scope << "," << name << "," << bucket << "," << a.second.triangles << "," << a.second.vertices << ","
+				<< a.first.acmr() << "," << a.second.acmr() << "," << a.first.atvr() << "," << a.second.atvr() << ","
+				<< a.first.overdraw() << "," << a.second.overdraw() << "," << a.first.overfetch() << "," << a.second.overfetch() << std::endl;
+		};
+		auto writeJson = [&](const std::pair<MeshAnalysis, MeshAnalysis>& a) {
+			ofileJson << "\"triangles\": " << a.second.triangles << ", \"vertices\": " << a.second.vertices
+				<< ", \"acmr\": [" << a.first.acmr() << ", " << a.second.acmr() << "]"
+				<< ", \"atvr\": [" << a.first.atvr() << ", " << a.second.atvr() << "]"
+				<< ", \"overdraw\": [" << a.first.overdraw() << ", " << a.second.overdraw() << "]"
+				<< ", \"overfetch\": [" << a.first.overfetch() << ", " << a.second.overfetch() << "]";
+		};
+
+		// every metric is a [before, after] optimization pair
+		ofileCsv << "scope,name,bucket,triangles,vertices,acmr_before,acmr_after,atvr_before,atvr_after,overdraw_before,overdraw_after,overfetch_before,overfetch_after" << std::endl;
+		ofileJson << "{\n\"preset\": \"" << (settings.useMeshOptimizer ? getOptLevelName(settings.optLevel) : "none") << "\",\n\"meshes\": [";
+		unsigned int drawIndex = 0;
+		for (auto it = matTypes.begin(); it != matTypes.end(); it++) {
+			for (auto& m : meshes.at(*it)) {
+				std::pair<MeshAnalysis, MeshAnalysis> a(m.analysisBefore, m.analysisAfter);
+				for (auto* sum : { &models[m.modelName], &buckets[*it], &scene }) {
+					sum->first.add(a.first);
+					sum->second.add(a.second);
+				}
+
+				writeCsv("mesh", m.modelName + "#" + std::to_string(drawIndex), bucketNames[static_cast<int>(*it)], a);
+				ofileJson << (drawIndex == 0 ? "\n" : ",\n") << "{ \"draw\": " << drawIndex << ", \"model\": \"" << m.modelName << "\", \"bucket\": \"" << bucketNames[static_cast<int>(*it)] << "\", ";
+				writeJson(a);
+				ofileJson << " }";
+				drawIndex++;
+			}
+		}
+
+		ofileJson << "\n],\n\"models\": {";
+		for (auto it = models.begin(); it != models.end(); it++) {
+			writeCsv("model", it->first, "", it->second);
+			ofileJson << (it == models.begin() ? "\n" : ",\n") << "\"" << it->first << "\": { ";
+			writeJson(it->second);
+			ofileJson << " }";
+		}
+
+		ofileJson << "\n},\n\"buckets\": {";
+		for (auto it = matTypes.begin(); it != matTypes.end(); it++) {
+			writeCsv("bucket", bucketNames[static_cast<int>(*it)], bucketNames[static_cast<int>(*it)], buckets[*it]);
+			ofileJson << (it == matTypes.begin() ? "\n" : ",\n") << "\"" << bucketNames[static_cast<int>(*it)] << "\": { ";
+			writeJson(buckets[*it]);
+			ofileJson << " }";
+		}
+
+		writeCsv("scene", "", "", scene);
+		ofileJson << "\n},\n\"scene\": { ";
+		writeJson(scene);
+		ofileJson << " }\n}" << std::endl;
+
+		ofileJson.flush();
+		ofileCsv.flush();
+	}
+	else
+		std::cout << "Error: " << "report files failed on creation." << std::endl;
+}
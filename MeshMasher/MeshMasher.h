@@ -2,38 +2,165 @@
 // or project specific include files.
 #pragma once
 #include "CQueue.h"
+#include "OutputFormat.h"
+#include <assimp/scene.h>
+#include <atomic>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 class CQueue;
 
+// how much work meshoptimizer puts into every mesh with -mo 1
+enum class OptLevel {
+	Fast,																					// fifo vertex cache order, no overdraw pass. for iteration builds
+	Balanced,																				// full vertex cache + overdraw, overdraw skipped on tiny meshes
+	Max,																					// full vertex cache + overdraw on every mesh
+	Strip																					// strip friendly vertex cache order + overdraw, smaller compressed index data
+};
+
+const char* getOptLevelName(OptLevel level);
+bool parseOptLevel(const char* name, OptLevel& level);
+
 struct Settings {
 	bool useMeshOptimizer;
 	bool preTransformVertices;
+	bool writeShadowData;
 	unsigned int numWorkerThreads;
-	Settings() : useMeshOptimizer(true), preTransformVertices(true), numWorkerThreads(2) {}
+	unsigned int chunkTriangles;															// meshes above this are split into chunks processed in parallel, 0 = never split
+	bool largestFirst;																		// push the tasks of every pass in order of estimated cost instead of scene order
+	OptLevel optLevel;
+	unsigned int meshTimeBudget;															// ms of optimization per mesh before the overdraw pass is dropped, 0 = no limit
+	bool writeReport;																		// run the meshoptimizer analyzers before / after optimization, report.json / report.csv
+	unsigned int triangleBudget;															// max triangles drawn by the whole scene, meshes are simplified to fit. 0 = no budget
+	unsigned int batchTriangles;															// meshes of one model + material below this are merged into one draw, 0 = no batching
+	bool writeContainer;																	// every output file becomes a page aligned section of output/dat.mmc
+	WriteBackend writeBackend;																// of the files written in parallel ranges (dat.vbf / dat.ebf)
+	bool directIo;																			// O_DIRECT with WriteBackend::Uring
+	bool streamGeometry;																	// write and free the geometry of every model as soon as it is processed
+	unsigned int compressionLevel;															// dat.vbf / dat.ebf / dat.rgb written as chunked dat.vbz / dat.ebz / dat.rgz, 0 = off
+	Settings() : useMeshOptimizer(true), preTransformVertices(true), writeShadowData(false), numWorkerThreads(2), chunkTriangles(1 << 20), largestFirst(true),
+		optLevel(OptLevel::Balanced), meshTimeBudget(0), writeReport(false), triangleBudget(0), batchTriangles(0), writeContainer(false),
+		writeBackend(WriteBackend::Sync), directIo(false), streamGeometry(false), compressionLevel(0) {}
+};
+
+// time the workers spent executing tasks vs the time they were available during the passes
+struct WorkerStats {
+	double busySeconds;
+	double workerSeconds;																	// wall time of every pass * num workers
+	unsigned int numPasses;
 };
 
 class MeshMasher{
 public:
 	MeshMasher(Settings settings = Settings());
+	~MeshMasher();
 	void run();												// default settings
+	void startWorkers();
+	void stopWorkers();
+	unsigned int getImportFlags() const;
+	void processModel(const aiScene* scene, const std::string& modelName);
+	void applyTriangleBudget();
+	void writeOutput();
+	WorkerStats getWorkerStats() const;
 	void loadMaterial(const aiMaterial* aiMat, Material& meshMat);
 	void loadTexture(Material& mat, const aiMaterial* aiMat, const aiTextureType textureType, const int stbVersion);
+	void splitMesh(const aiMesh* aimesh, Mesh& firstChunk);
+	void remapMesh(const aiMesh* aimesh, Mesh& mesh);
 	void loadMesh(const aiMesh* aimesh, Mesh& mesh);
-	void writeLoaderData();
-	void writeVBufferData();
-	void writeEBufferData();
-	void writeMaterialData();
-	void writeTextureData();
+	void loadShadowMesh(Mesh& mesh);
+	void simplifyMesh(Mesh& mesh);
+	void refreshBudgetMesh(Mesh& mesh);												// after applyTriangleBudget, with the simplified indices
+	void finishBatch(Mesh& mesh);
+	void writeLoaderData(std::ostream& ofile);
+	void writeVBufferData(std::ostream& ofile);
+	void writeEBufferData(std::ostream& ofile);
+	void writeMaterialData(std::ostream& ofile);
+	void writeTextureData(std::ostream& ofile);
+	void writeImageData(std::ostream& ofile);
+	void writeShadowLoaderData(std::ostream& ofile);
+	void writeShadowVBufferData(std::ostream& ofile);
+	void writeShadowEBufferData(std::ostream& ofile);
+	void writeInstanceData(std::ostream& ofile);
+	void writeContainerData();
+	void writeFileRange(OutputFile& file, const FileRange& range);
+	void compressChunk(CompressedFile& file, size_t chunk);
+	void writeReportData();
 
 private:
 	Settings settings;
 	CQueue cqueue;
+	std::vector<std::jthread> threads;
+	std::unique_ptr<std::latch> latchThreads;
 	unsigned int currBaseInstance;
 	std::map<std::string, unsigned int> modelBaseInstances;
 	std::map<MaterialType, std::vector<Mesh>> meshes;										// opaque material meshes are always last to render
+	std::map<MaterialType, GeometryArena> arenas;											// vertex / index data of all meshes in "meshes"
 	std::map<std::string, std::vector<Material>> materials;									// get material using model name as key for each mesh
 	std::map<std::string, Texture> textures;												// use texture filename to access texture
+	std::mutex textureMutex;																// textures is filled by the material tasks of every worker
+	std::vector<MaterialRecord> materialTable;												// dat.mtr, the materials of every model deduplicated
+	std::map<std::string, std::vector<uint32_t>> materialIds;								// record of every material of a model in materialTable
+	std::vector<TextureEntry> textureTable;													// dat.txr, every decoded texture in name order
+	std::vector<MipDescriptor> mipTable;
+	std::map<std::string, int32_t> textureIndices;											// texture name -> entry in textureTable
+	std::map<std::string, CompressedFile> compressedFiles;									// -lz, by the extension of the raw file
+	std::multimap<uint64_t, std::pair<MaterialType, size_t>> uniqueMeshes;					// content hash -> record owning the range, for dedupMeshes
+	size_t dedupMeshCount, dedupBytes;
+	size_t batchedMeshCount, batchCount;
+	std::vector<aiMatrix4x4> instanceTransforms;											// node transforms of every model, each mesh owns a contiguous range
+
+	size_t sizeVbf, sizeEbf, sizeRgb;															// size in bytes of data to be read by geometry loaders
+
+	// -st 1, dat.vbf / dat.ebf for tex geometry and temporary extents for opa geometry, appended behind it at the end
+	struct GeometryStream {
+		OutputFile vertices, indices;
+	};
+	std::map<MaterialType, GeometryStream> streams;
+	size_t peakArenaBytes;
+
+	// where the shadow range of every draw record lands in dat.svb / dat.seb, in draw order. records sharing a
+	// deduplicated range share its shadow range, only the owner writes it
+	struct ShadowRange {
+		const Mesh* mesh;
+		unsigned int baseVertex, firstIndex;
+		bool owner;
+	};
+	std::vector<ShadowRange> shadowRanges;
+	size_t sizeSvb, sizeSeb;
+
+	// one output file, or one section of dat.mmc with -ct 1
+	struct OutputSection {
+		const char* name;																	// file extension / section name
+		void (MeshMasher::* writer)(std::ostream&);											// nullptr when the ranges cover the whole file
+		size_t cost;																		// bytes written, orders the writer tasks
+		std::vector<FileRange> ranges;														// when set the file is preallocated and the ranges written in parallel instead
+	};
 
-	size_t sizeVbf, sizeEbf, primCount;														// size in bytes of data to be read by geometry loaders
+	std::atomic<long long> busyNanos;														// summed over all workers
+	std::atomic<unsigned int> overdrawSkipped;												// meshes that ran out of their time budget before the overdraw pass
+	WorkerStats workerStats;
 
+	void runPass(std::vector<std::pair<size_t, Command*>>& tasks);
+	size_t estimateMaterialCost(const aiMaterial* aiMat) const;
+	void collectInstances(const aiNode* node, const aiMatrix4x4& parentTransform, std::vector<std::vector<aiMatrix4x4>>& meshInstances) const;
+	unsigned int getNumChunks(const aiMesh* aimesh) const;
+	void optimizeVertexCache(unsigned int* indices, size_t indexCount, size_t vertexCount) const;
+	MeshAnalysis analyzeMesh(const Vertex* vertices, const unsigned int* indices, const Mesh& mesh) const;
+	void planIndexRanges(const std::vector<std::pair<const aiMesh*, Mesh*>>& modelMeshes);
+	void planVertexRanges(const std::vector<std::pair<const aiMesh*, Mesh*>>& modelMeshes);
+	void batchMeshes(std::vector<std::pair<const aiMesh*, Mesh*>>& modelMeshes);
+	void dedupMeshes(const std::vector<std::pair<const aiMesh*, Mesh*>>& modelMeshes);
+	void planTextures();
+	void planMaterials();
+	void compressOutput();
+	void planShadowRanges();
+	void startStreaming();
+	void flushGeometry();
+	void finishStreaming();
+	std::vector<OutputSection> getOutputSections() const;
+	std::vector<FileRange> getArenaRanges(bool indices) const;
+	void writeLoaderFile(std::ostream& ofile, uint64_t sizeVertices, uint64_t sizeIndices, const std::vector<DrawElementsIndirectCommand>& commands,
+		const std::vector<DrawInfo>& drawInfos, const std::vector<DrawBounds>* bounds);
 };
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <vector>
 #include <assimp/material.h>
 #include <assimp/mesh.h>
@@ -25,7 +26,7 @@ struct Material {
 	std::map<aiTextureType, std::string> textureNames;
 	bool useAlphaTex;
 	bool useDiffuseAlpha;																// true means using diffuse texture w parameter for opacity value, otherwise use opacity variable with color
-	Material() : useAlphaTex(false), useDiffuseAlpha(true) {}
+	Material() : opacity(1.f), color{ 1.f, 1.f, 1.f, 1.f }, type(MaterialType::Tex), useAlphaTex(false), useDiffuseAlpha(true) {}
 };
 
 struct Vertex {
@@ -36,11 +37,71 @@ struct Vertex {
 	Vertex(aiVector3D pos, aiVector2D texCoord, aiVector3D normal) : pos(pos), texCoord(texCoord), normal(normal) {}
 };
 
+struct Bounds {
+	aiVector3D min, max;																// axis aligned bounding box
+	aiVector3D center;																	// bounding sphere around the aabb center
+	float radius;
+	Bounds() : radius(0.f) {}
+};
+
+// raw counters of the meshoptimizer analyzers, kept as sums so they aggregate over meshes exactly
+struct MeshAnalysis {
+	size_t triangles, vertices, vertexBytes;
+	size_t verticesTransformed;															// 16 entry fifo cache
+	size_t pixelsCovered, pixelsShaded;
+	size_t bytesFetched;
+	MeshAnalysis() : triangles(0), vertices(0), vertexBytes(0), verticesTransformed(0), pixelsCovered(0), pixelsShaded(0), bytesFetched(0) {}
+
+	void add(const MeshAnalysis& other) {
+		triangles += other.triangles;
+		vertices += other.vertices;
+		vertexBytes += other.vertexBytes;
+		verticesTransformed += other.verticesTransformed;
+		pixelsCovered += other.pixelsCovered;
+		pixelsShaded += other.pixelsShaded;
+		bytesFetched += other.bytesFetched;
+	}
+	double acmr() const { return triangles ? double(verticesTransformed) / triangles : 0.0; }
+	double atvr() const { return vertices ? double(verticesTransformed) / vertices : 0.0; }
+	double overdraw() const { return pixelsCovered ? double(pixelsShaded) / pixelsCovered : 0.0; }
+	double overfetch() const { return vertexBytes ? double(bytesFetched) / vertexBytes : 0.0; }
+};
+
+// one simplified level of a mesh for the -tri scene triangle budget
+struct MeshLod {
+	std::vector<unsigned int> indices;													// into the vertex range of the mesh, vertices are never changed
+	float error;																		// absolute object space error of meshopt_simplify
+};
+
 struct Mesh {
-	std::vector<Vertex> vertices;
-	std::vector<unsigned int> indices;
+	MaterialType matType;																// geometry lives in the arena of this material type
+	unsigned int baseVertex, vertexCount;												// range in the vertex arena
+	unsigned int firstIndex, indexCount;												// range in the index arena
 	unsigned int materialIndex;
+	unsigned int firstInstance, instanceCount;											// range of node transforms in dat.ins, one per scene graph node referencing the mesh
+	Bounds bounds;																		// object space bounds written per draw record for gpu culling
+	std::vector<aiVector3D> shadowVertices;												// position only stream and indices for depth prepass / shadow map draws
+	std::vector<unsigned int> shadowIndices;
+	std::vector<unsigned int> sourceVertices;											// assimp vertex of every remapped vertex, only kept between the remap and load passes
+	bool isChunk;																		// part of a split mesh, indices were already placed in the arena by splitMesh
+	uint64_t contentHash;																// over the processed vertices and indices, identical meshes share one range
+	MeshAnalysis analysisBefore, analysisAfter;											// only filled in for the -rp report
+	std::vector<MeshLod> lods;															// coarser with every level, only kept while the triangle budget is applied
 	std::string modelName;																//parent model filename used to identify material from maps as key
 	Mesh() = default;
-	Mesh(std::string modelName) : modelName(modelName) {}
+	Mesh(std::string modelName, MaterialType matType) : matType(matType), baseVertex(0), vertexCount(0), firstIndex(0), indexCount(0), materialIndex(0), firstInstance(0), instanceCount(0), isChunk(false), contentHash(0), modelName(modelName) {}
+};
+
+// all processed geometry of one material type, workers write straight into the mesh ranges so nothing is merged or copied later
+// mesh ranges are arena wide offsets, with -st 1 the geometry of finished models is written out and dropped from the front
+struct GeometryArena {
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	size_t flushedVertices, flushedIndices;												// already written, vertices[0] is vertex flushedVertices
+	GeometryArena() : flushedVertices(0), flushedIndices(0) {}
+
+	size_t vertexEnd() const { return flushedVertices + vertices.size(); }
+	size_t indexEnd() const { return flushedIndices + indices.size(); }
+	Vertex* vertexAt(size_t vertex) { return vertices.data() + (vertex - flushedVertices); }
+	unsigned int* indexAt(size_t index) { return indices.data() + (index - flushedIndices); }
 };
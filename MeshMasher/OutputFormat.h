@@ -0,0 +1,197 @@
+#pragma once
+#include <cstdint>
+
+// binary layouts of the output files, shared by the writers and by loaders. little endian, no assimp types
+// so a loader only needs this header
+
+// one dat.vbf vertex, the Vertex of Model.h without the assimp types
+struct PackedVertex {
+	float position[3];
+	float texCoord[2];
+	float normal[3];
+};
+static_assert(sizeof(PackedVertex) == 32, "vertex layout changed");
+
+// one dat.ins transform, column major like a glsl mat4
+struct InstanceTransform {
+	float m[16];
+};
+
+// layout of GL_DRAW_INDIRECT_BUFFER entries for glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+	uint32_t count;
+	uint32_t instanceCount;
+	uint32_t firstIndex;
+	int32_t baseVertex;
+	uint32_t baseInstance;																// firstInstance into dat.ins, gl_BaseInstance + gl_InstanceID is the transform
+};
+static_assert(sizeof(DrawElementsIndirectCommand) == 20, "indirect command must match the GL layout");
+
+// per draw side table, indexed with gl_DrawID
+struct DrawInfo {
+	uint32_t materialIndex;																// into the material table of dat.mtr
+	uint32_t modelId;																	// into the model name table
+};
+
+// per draw object space bounds, vec4 aligned for a std430 culling pass
+struct DrawBounds {
+	float center[3];
+	float radius;																		// bounding sphere around the aabb center
+	float min[3];
+	float pad0;
+	float max[3];
+	float pad1;
+};
+static_assert(sizeof(DrawBounds) == 48, "bounds must match the std430 layout");
+
+// model name table entry, the names are packed right after the entries and not null terminated
+struct ModelName {
+	uint32_t offset;																	// from the start of the name table
+	uint32_t length;
+};
+
+// dat.ldr / dat.sdr, every section starts on a 16 byte boundary and offsets are from the start of the file
+// so the command array can be mapped or copied straight into the indirect buffer
+struct LoaderHeader {
+	char magic[4];																		// "MMLD"
+	uint32_t version;
+	uint64_t sizeVbf, sizeEbf;															// bytes in dat.vbf / dat.ebf, dat.svb / dat.seb for dat.sdr
+	uint32_t primCount;																	// entries in every per draw section
+	uint32_t numModels;
+	uint64_t commandsOffset;															// primCount DrawElementsIndirectCommand
+	uint64_t drawInfoOffset;															// primCount DrawInfo
+	uint64_t boundsOffset;																// primCount DrawBounds, 0 when the file has none (dat.sdr)
+	uint64_t modelNamesOffset;															// numModels ModelName followed by the names
+};
+static_assert(sizeof(LoaderHeader) == 64, "loader header layout changed");
+
+const uint32_t LoaderVersion = 2;
+
+// MaterialRecord::flags
+enum MaterialFlags : uint32_t {
+	MaterialBlend = 1 << 0,																// MaterialType::Opa, drawn after every opaque draw
+	MaterialAlphaTexture = 1 << 1,														// opacity from opacityTexture
+	MaterialDiffuseAlpha = 1 << 2,														// opacity from the alpha of diffuseTexture, otherwise from opacity
+};
+
+// one material in std430 layout, glsl : struct Material { vec4 color; float opacity; uint flags; int diffuseTexture;
+// int normalTexture; int emissiveTexture; int opacityTexture; }; the array stride is rounded up to the vec4 alignment
+struct MaterialRecord {
+	float color[4];																		// diffuse color, rgba
+	float opacity;
+	uint32_t flags;																		// MaterialFlags
+	int32_t diffuseTexture;																// index into the textures of dat.txr, also the layer of an array texture holding them. -1 for none
+	int32_t normalTexture;
+	int32_t emissiveTexture;
+	int32_t opacityTexture;
+	uint32_t pad[2];
+};
+static_assert(sizeof(MaterialRecord) == 48, "material must match the std430 layout");
+
+// dat.mtr, materials identical over models are stored once and DrawInfo::materialIndex picks the record, so the
+// whole table is uploaded once as an ssbo for the single multi draw
+struct MaterialHeader {
+	char magic[4];																		// "MMMT"
+	uint32_t version;
+	uint32_t numMaterials;
+	uint32_t recordsOffset;																// from the start of the file, numMaterials MaterialRecord
+};
+static_assert(sizeof(MaterialHeader) == 16, "material header layout changed");
+
+const uint32_t MaterialVersion = 1;
+
+// TextureEntry::format, the gl sized internal format of the pixel data
+enum TextureFormat : uint32_t {
+	TextureRGB8 = 0x8051,																// GL_RGB8, 3 channels
+	TextureRGBA8 = 0x8058,																// GL_RGBA8, 4 channels
+};
+
+// one level of a texture in dat.rgb, tightly packed rows
+struct MipDescriptor {
+	uint64_t offset;																	// from the start of dat.rgb
+	uint64_t size;																		// bytes, width * height * channels
+	uint32_t width, height;
+};
+static_assert(sizeof(MipDescriptor) == 24, "mip descriptor layout changed");
+
+// one texture of dat.txr, sizes are computed from the decoded dimensions so a loader can read and upload any
+// texture on its own. MaterialRecord texture indices point into these entries
+struct TextureEntry {
+	uint64_t offset;																	// from the start of dat.rgb, 16 byte aligned, the data of mip 0
+	uint64_t size;																		// bytes of all levels
+	uint32_t width, height;
+	uint32_t channels;
+	uint32_t format;																	// TextureFormat
+	uint32_t firstMip, numMips;															// range in the mip table, level 0 first
+	uint32_t nameOffset, nameLength;													// in the name table, not null terminated
+};
+static_assert(sizeof(TextureEntry) == 48, "texture entry layout changed");
+
+// dat.txr, sections on 16 byte boundaries with offsets from the start of the file like dat.ldr
+struct TextureHeader {
+	char magic[4];																		// "MMTX"
+	uint32_t version;
+	uint32_t numTextures;
+	uint32_t numMips;
+	uint64_t sizeRgb;																	// bytes in dat.rgb
+	uint64_t entriesOffset;																// numTextures TextureEntry
+	uint64_t mipsOffset;																// numMips MipDescriptor
+	uint64_t namesOffset;																// the texture names
+};
+static_assert(sizeof(TextureHeader) == 48, "texture header layout changed");
+
+const uint32_t TextureVersion = 1;
+
+// CompressedChunk::flags
+enum CompressedChunkFlags : uint32_t {
+	CompressedStored = 1 << 0,															// compression did not pay off, the chunk is the raw bytes
+};
+
+// one chunk of a compressed file, chunk i decompresses to the raw bytes [i * chunkSize, (i + 1) * chunkSize)
+struct CompressedChunk {
+	uint64_t offset;																	// from the start of the file
+	uint32_t size;																		// compressed bytes
+	uint32_t flags;																		// CompressedChunkFlags
+};
+static_assert(sizeof(CompressedChunk) == 16, "compressed chunk layout changed");
+
+// dat.vbz / dat.ebz / dat.rgz with -lz, dat.vbf / dat.ebf / dat.rgb cut into chunks compressed on their own in the lz4 block
+// format (see Codec.h). a loader can start on any chunk and decompress all of them in parallel straight into its buffers
+struct CompressedHeader {
+	char magic[4];																		// "MMLZ"
+	uint32_t version;
+	uint32_t level;																		// of the codec, only informative
+	uint32_t chunkSize;																	// raw bytes of every chunk but the last
+	uint64_t rawSize;																	// bytes of the uncompressed file
+	uint32_t numChunks;
+	uint32_t reserved;
+	uint64_t chunksOffset;																// numChunks CompressedChunk, the chunk data follows on a 16 byte boundary
+};
+static_assert(sizeof(CompressedHeader) == 40, "compressed header layout changed");
+
+const uint32_t CompressedVersion = 1;
+const uint32_t CompressedChunkSize = 1 << 18;												// written by MeshMasher, loaders use the header
+
+// dat.mmc with -ct 1, every output file stored unchanged as one section. the table of contents of numSections
+// ContainerSection follows the header and every section starts on a ContainerAlignment boundary, so a loader
+// maps the file once and hands the section pointers straight to persistently mapped buffers
+struct ContainerHeader {
+	char magic[4];																		// "MMCT"
+	uint32_t version;
+	uint32_t numSections;
+	uint32_t alignment;																	// of every section offset, ContainerAlignment
+	uint64_t fileSize;
+	uint64_t reserved;
+};
+static_assert(sizeof(ContainerHeader) == 32, "container header layout changed");
+
+struct ContainerSection {
+	char name[8];																		// file extension of the section, "ldr", "vbf" ... zero padded
+	uint64_t offset;																	// from the start of the file
+	uint64_t size;																		// bytes, without the padding up to the next section
+	uint64_t reserved;
+};
+static_assert(sizeof(ContainerSection) == 32, "container section layout changed");
+
+const uint32_t ContainerVersion = 1;
+const uint32_t ContainerAlignment = 4096;													// page size, also a multiple of every element size
@@ -0,0 +1,421 @@
+#include "Reader.h"
+#include "Codec.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	// the sections are page / 16 byte aligned so the mapped bytes can be viewed as the structs of OutputFormat.h
+	template <typename T>
+	std::span<const T> asSpan(std::span<const std::byte> bytes) {
+		return { reinterpret_cast<const T*>(bytes.data()), bytes.size() / sizeof(T) };
+	}
+
+	std::string_view asText(std::span<const std::byte> bytes) {
+		return { reinterpret_cast<const char*>(bytes.data()), bytes.size() };
+	}
+
+	// only looks the file up, opening picks dat.mmc or the separate files and must not map anything twice
+	bool fileExists(const std::string& path) {
+#ifdef _WIN32
+		DWORD attributes = GetFileAttributesA(path.c_str());
+		return attributes != INVALID_FILE_ATTRIBUTES && !(attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+		struct stat status;
+		return stat(path.c_str(), &status) == 0 && S_ISREG(status.st_mode);
+#endif
+	}
+}
+
+#ifdef _WIN32
+MappedFile::MappedFile() : data(nullptr), size(0), file(INVALID_HANDLE_VALUE), mapping(nullptr) {}
+
+bool MappedFile::open(const std::string& path) {
+	close();
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) {
+		close();
+		return false;
+	}
+	size = static_cast<size_t>(fileSize.QuadPart);
+	if (size == 0)
+		return true;
+
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping != nullptr)
+		data = static_cast<const std::byte*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (data == nullptr) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close() {
+	if (data != nullptr)
+		UnmapViewOfFile(data);
+	if (mapping != nullptr)
+		CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	data = nullptr;
+	size = 0;
+	mapping = nullptr;
+	file = INVALID_HANDLE_VALUE;
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept : data(other.data), size(other.size), file(other.file), mapping(other.mapping) {
+	other.data = nullptr;
+	other.size = 0;
+	other.file = INVALID_HANDLE_VALUE;
+	other.mapping = nullptr;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+	if (this != &other) {
+		close();
+		std::swap(data, other.data);
+		std::swap(size, other.size);
+		std::swap(file, other.file);
+		std::swap(mapping, other.mapping);
+	}
+	return *this;
+}
+#else
+MappedFile::MappedFile() : data(nullptr), size(0) {}
+
+bool MappedFile::open(const std::string& path) {
+	close();
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat status;
+	if (fstat(fd, &status) != 0) {
+		::close(fd);
+		return false;
+	}
+
+	// empty files can not be mapped but are valid, an empty section
+	size = static_cast<size_t>(status.st_size);
+	void* mapped = size != 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+	::close(fd);
+	if (mapped == MAP_FAILED) {
+		size = 0;
+		return false;
+	}
+	data = static_cast<const std::byte*>(mapped);
+	return true;
+}
+
+void MappedFile::close() {
+	if (data != nullptr)
+		munmap(const_cast<std::byte*>(data), size);
+	data = nullptr;
+	size = 0;
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept : data(other.data), size(other.size) {
+	other.data = nullptr;
+	other.size = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+	if (this != &other) {
+		close();
+		std::swap(data, other.data);
+		std::swap(size, other.size);
+	}
+	return *this;
+}
+#endif
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+bool OutputReader::open(const std::string& directory, unsigned int numThreads) {
+	close();
+	std::string container = directory + "/dat.mmc";
+	bool mapped = fileExists(container) ? mapContainer(container) : mapFiles(directory);
+	if (!mapped)
+		return false;
+
+	for (auto& [compressedName, rawName] : { std::pair{ "vbz", "vbf" }, std::pair{ "ebz", "ebf" }, std::pair{ "rgz", "rgb" } }) {
+		if (sections.count(compressedName) != 0 && sections.count(rawName) == 0 && !decompressSection(compressedName, rawName, numThreads))
+			return false;
+	}
+	for (const char* name : { "ldr", "vbf", "ebf" }) {
+		if (sections.count(name) == 0)
+			return fail(directory + " has no dat." + name);
+	}
+
+	auto vbf = getSection("vbf"), ebf = getSection("ebf");
+	vertices = asSpan<PackedVertex>(vbf);
+	indices = asSpan<uint32_t>(ebf);
+	instanceTransforms = asSpan<InstanceTransform>(getSection("ins"));
+	if (!parseLoader(getSection("ldr"), vbf.size(), ebf.size(), commands, true) || !parseMaterials() || !parseTextures())
+		return false;
+
+	if (sections.count("sdr") != 0) {
+		auto svb = getSection("svb"), seb = getSection("seb");
+		shadowVertices = asSpan<float>(svb);
+		shadowIndices = asSpan<uint32_t>(seb);
+		if (!parseLoader(getSection("sdr"), svb.size(), seb.size(), shadowCommands, false))
+			return false;
+	}
+	return true;
+}
+
+void OutputReader::close() {
+	*this = OutputReader();
+}
+
+std::span<const std::byte> OutputReader::getSection(const std::string& name) const {
+	auto section = sections.find(name);
+	return section != sections.end() ? section->second : std::span<const std::byte>();
+}
+
+bool OutputReader::getSectionLocation(const std::string& name, SectionLocation& location) const {
+	auto section = locations.find(name);
+	if (section == locations.end())
+		return false;
+	location = section->second;
+	return true;
+}
+
+bool OutputReader::fail(const std::string& message) {
+	error = message;
+	return false;
+}
+
+bool OutputReader::mapContainer(const std::string& path) {
+	MappedFile file;
+	if (!file.open(path))
+		return fail(path + " could not be mapped");
+	auto bytes = file.getBytes();
+
+	ContainerHeader header;
+	if (bytes.size() < sizeof(header))
+		return fail(path + " is truncated");
+	memcpy(&header, bytes.data(), sizeof(header));
+	if (memcmp(header.magic, "MMCT", 4) != 0 || header.version != ContainerVersion)
+		return fail(path + " is not a version " + std::to_string(ContainerVersion) + " container");
+	if (sizeof(header) + sizeof(ContainerSection) * static_cast<uint64_t>(header.numSections) > bytes.size())
+		return fail(path + " table of contents is truncated");
+
+	for (uint32_t s = 0; s < header.numSections; s++) {
+		ContainerSection section;
+		memcpy(&section, bytes.data() + sizeof(header) + sizeof(section) * s, sizeof(section));
+		if (section.offset > bytes.size() || section.size > bytes.size() - section.offset)
+			return fail(path + " section " + std::to_string(s) + " is out of bounds");
+		std::string name(section.name, strnlen(section.name, sizeof(section.name)));
+		sections[name] = bytes.subspan(section.offset, section.size);
+		locations[name] = { path, section.offset, section.size };
+	}
+	files.push_back(std::move(file));
+	return true;
+}
+
+bool OutputReader::mapFiles(const std::string& directory) {
+	for (const char* name : { "ldr", "vbf", "ebf", "vbz", "ebz", "ins", "mtr", "txr", "rgb", "rgz", "sdr", "svb", "seb" }) {
+		MappedFile file;
+		std::string path = directory + "/dat." + name;
+		if (!file.open(path))
+			continue;
+		sections[name] = file.getBytes();
+		locations[name] = { path, 0, file.getBytes().size() };
+		files.push_back(std::move(file));
+	}
+	return true;
+}
+
+bool OutputReader::decompressSection(const std::string& compressedName, const std::string& rawName, unsigned int numThreads) {
+	CompressedHeader header;
+	std::span<const CompressedChunk> chunks;
+	auto compressed = getSection(compressedName);
+	if (!getCompressedChunks(compressed, header, chunks))
+		return fail("dat." + compressedName + " is not a valid compressed file");
+	decompressed.emplace_back(static_cast<size_t>(header.rawSize));
+	if (!decompressParallel(decompressed.back().data(), compressed, numThreads))
+		return fail("dat." + compressedName + " failed to decompress");
+	sections[rawName] = decompressed.back();
+	return true;
+}
+
+bool OutputReader::parseLoader(std::span<const std::byte> ldr, uint64_t sizeVbf, uint64_t sizeEbf, std::span<const DrawElementsIndirectCommand>& drawCommands,
+	bool readTables) {
+	LoaderHeader header;
+	if (ldr.size() < sizeof(header))
+		return fail("loader data is truncated");
+	memcpy(&header, ldr.data(), sizeof(header));
+	if (memcmp(header.magic, "MMLD", 4) != 0 || header.version != LoaderVersion)
+		return fail("loader data is not version " + std::to_string(LoaderVersion));
+	if (header.sizeVbf != sizeVbf || header.sizeEbf != sizeEbf)
+		return fail("loader data does not match the size of the vertex / index data");
+
+	auto table = [&](uint64_t offset, size_t elementSize, size_t count, std::span<const std::byte>& bytes) {
+		if (offset > ldr.size() || elementSize * count > ldr.size() - offset)
+			return false;
+		bytes = ldr.subspan(offset, elementSize * count);
+		return true;
+	};
+	std::span<const std::byte> bytes;
+	if (!table(header.commandsOffset, sizeof(DrawElementsIndirectCommand), header.primCount, bytes))
+		return fail("loader draw commands are out of bounds");
+	drawCommands = asSpan<DrawElementsIndirectCommand>(bytes);
+	if (!readTables)
+		return true;
+
+	if (!table(header.drawInfoOffset, sizeof(DrawInfo), header.primCount, bytes))
+		return fail("loader draw infos are out of bounds");
+	drawInfos = asSpan<DrawInfo>(bytes);
+	if (header.boundsOffset != 0) {
+		if (!table(header.boundsOffset, sizeof(DrawBounds), header.primCount, bytes))
+			return fail("loader bounds are out of bounds");
+		bounds = asSpan<DrawBounds>(bytes);
+	}
+
+	if (!table(header.modelNamesOffset, sizeof(ModelName), header.numModels, bytes))
+		return fail("loader model names are out of bounds");
+	auto names = ldr.subspan(header.modelNamesOffset);
+	for (auto& entry : asSpan<ModelName>(bytes)) {
+		if (entry.offset > names.size() || entry.length > names.size() - entry.offset)
+			return fail("loader model name is out of bounds");
+		modelNames.push_back(asText(names.subspan(entry.offset, entry.length)));
+	}
+	return true;
+}
+
+bool OutputReader::parseMaterials() {
+	auto mtr = getSection("mtr");
+	MaterialHeader header;
+	if (mtr.size() < sizeof(header))
+		return fail("dat.mtr is truncated");
+	memcpy(&header, mtr.data(), sizeof(header));
+	if (memcmp(header.magic, "MMMT", 4) != 0 || header.version != MaterialVersion)
+		return fail("dat.mtr is not version " + std::to_string(MaterialVersion));
+	if (header.recordsOffset > mtr.size() || sizeof(MaterialRecord) * static_cast<uint64_t>(header.numMaterials) > mtr.size() - header.recordsOffset)
+		return fail("dat.mtr records are out of bounds");
+	materials = asSpan<MaterialRecord>(mtr.subspan(header.recordsOffset, sizeof(MaterialRecord) * header.numMaterials));
+
+	for (auto& drawInfo : drawInfos) {
+		if (drawInfo.materialIndex >= materials.size())
+			return fail("loader draw info points past the material table");
+	}
+	return true;
+}
+
+bool OutputReader::parseTextures() {
+	auto txr = getSection("txr"), rgb = getSection("rgb");
+	TextureHeader header;
+	if (txr.size() < sizeof(header))
+		return fail("dat.txr is truncated");
+	memcpy(&header, txr.data(), sizeof(header));
+	if (memcmp(header.magic, "MMTX", 4) != 0 || header.version != TextureVersion)
+		return fail("dat.txr is not version " + std::to_string(TextureVersion));
+	if (header.sizeRgb != rgb.size())
+		return fail("dat.txr does not match the size of dat.rgb");
+
+	auto table = [&](uint64_t offset, size_t elementSize, size_t count, std::span<const std::byte>& bytes) {
+		if (offset > txr.size() || elementSize * count > txr.size() - offset)
+			return false;
+		bytes = txr.subspan(offset, elementSize * count);
+		return true;
+	};
+	std::span<const std::byte> entryBytes, mipBytes;
+	if (!table(header.entriesOffset, sizeof(TextureEntry), header.numTextures, entryBytes) || !table(header.mipsOffset, sizeof(MipDescriptor), header.numMips, mipBytes) ||
+		header.namesOffset > txr.size())
+		return fail("dat.txr tables are out of bounds");
+	auto mips = asSpan<MipDescriptor>(mipBytes);
+	auto names = txr.subspan(header.namesOffset);
+
+	for (auto& entry : asSpan<TextureEntry>(entryBytes)) {
+		if (entry.nameOffset > names.size() || entry.nameLength > names.size() - entry.nameOffset || entry.firstMip > mips.size() ||
+			entry.numMips > mips.size() - entry.firstMip || entry.offset > rgb.size() || entry.size > rgb.size() - entry.offset)
+			return fail("dat.txr entry " + std::to_string(textures.size()) + " is out of bounds");
+		auto textureMips = mips.subspan(entry.firstMip, entry.numMips);
+		for (auto& mip : textureMips) {
+			if (mip.offset < entry.offset || mip.offset > entry.offset + entry.size || mip.size > entry.offset + entry.size - mip.offset)
+				return fail("dat.txr mip of entry " + std::to_string(textures.size()) + " is outside its texture");
+		}
+		textures.push_back({ asText(names.subspan(entry.nameOffset, entry.nameLength)), entry.width, entry.height, entry.channels, entry.format,
+			rgb.subspan(entry.offset, entry.size), textureMips });
+	}
+	return true;
+}
+
+void OutputReader::copyParallel(void* dst, std::span<const std::byte> src, unsigned int numThreads, size_t chunkSize) {
+	// the calling thread copies too, chunks are handed out in order so every thread streams through neighbouring pages
+	std::atomic<size_t> next(0);
+	auto copyChunks = [&]() {
+		for (size_t offset = next.fetch_add(chunkSize); offset < src.size(); offset = next.fetch_add(chunkSize))
+			memcpy(static_cast<std::byte*>(dst) + offset, src.data() + offset, std::min(chunkSize, src.size() - offset));
+	};
+	size_t numChunks = (src.size() + chunkSize - 1) / chunkSize;
+	std::vector<std::jthread> threads;
+	for (size_t t = 1; t < std::min<size_t>(numThreads, numChunks); t++)
+		threads.emplace_back(copyChunks);
+	copyChunks();
+}
+
+bool OutputReader::getCompressedChunks(std::span<const std::byte> compressed, CompressedHeader& header, std::span<const CompressedChunk>& chunks) {
+	if (compressed.size() < sizeof(header))
+		return false;
+	memcpy(&header, compressed.data(), sizeof(header));
+	if (memcmp(header.magic, "MMLZ", 4) != 0 || header.version != CompressedVersion || header.chunkSize == 0 ||
+		header.numChunks != (header.rawSize + header.chunkSize - 1) / header.chunkSize)
+		return false;
+	if (header.chunksOffset > compressed.size() || sizeof(CompressedChunk) * static_cast<uint64_t>(header.numChunks) > compressed.size() - header.chunksOffset)
+		return false;
+	chunks = asSpan<CompressedChunk>(compressed.subspan(header.chunksOffset, sizeof(CompressedChunk) * header.numChunks));
+
+	for (size_t c = 0; c < chunks.size(); c++) {
+		uint64_t rawSize = std::min<uint64_t>(header.chunkSize, header.rawSize - c * header.chunkSize);
+		if (chunks[c].offset > compressed.size() || chunks[c].size > compressed.size() - chunks[c].offset ||
+			((chunks[c].flags & CompressedStored) != 0 && chunks[c].size != rawSize))
+			return false;
+	}
+	return true;
+}
+
+bool OutputReader::decompressParallel(void* dst, std::span<const std::byte> compressed, unsigned int numThreads) {
+	// chunks are independent, every thread takes the next one like copyParallel
+	CompressedHeader header;
+	std::span<const CompressedChunk> chunks;
+	if (!getCompressedChunks(compressed, header, chunks))
+		return false;
+	std::atomic<size_t> next(0);
+	std::atomic<bool> ok(true);
+	auto decompressChunks = [&]() {
+		for (size_t c = next++; c < chunks.size(); c = next++) {
+			std::byte* out = static_cast<std::byte*>(dst) + c * header.chunkSize;
+			size_t rawSize = static_cast<size_t>(std::min<uint64_t>(header.chunkSize, header.rawSize - c * header.chunkSize));
+			const std::byte* in = compressed.data() + chunks[c].offset;
+			if ((chunks[c].flags & CompressedStored) != 0)
+				memcpy(out, in, rawSize);
+			else if (!decompressBlock(in, chunks[c].size, out, rawSize))
+				ok = false;
+		}
+	};
+	std::vector<std::jthread> threads;
+	for (size_t t = 1; t < std::min<size_t>(numThreads, chunks.size()); t++)
+		threads.emplace_back(decompressChunks);
+	decompressChunks();
+	threads.clear();
+	return ok;
+}
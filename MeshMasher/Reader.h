@@ -0,0 +1,117 @@
+// Reader.h : MeshMasherReader, zero copy access to the MeshMasher output for loaders
+// only depends on OutputFormat.h, no assimp or meshoptimizer
+#pragma once
+#include "OutputFormat.h"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// read only mapping of a whole file
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const std::string& path);
+	void close();
+	std::span<const std::byte> getBytes() const { return { data, size }; }
+
+private:
+	const std::byte* data;
+	size_t size;
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#endif
+};
+
+// one entry of dat.txr, data points into dat.rgb
+struct TextureView {
+	std::string_view name;
+	uint32_t width, height;
+	uint32_t channels;
+	uint32_t format;																		// TextureFormat
+	std::span<const std::byte> data;														// all levels
+	std::span<const MipDescriptor> mips;													// offsets are into dat.rgb, level 0 first
+};
+
+// where a section is stored, for loaders that read it with their own io instead of through the mapping
+struct SectionLocation {
+	std::string path;
+	uint64_t offset;
+	uint64_t size;
+};
+
+// Maps the output of one MeshMasher run, dat.mmc when it exists or else the separate dat.* files, and hands out typed spans
+// straight into the mappings. Nothing is copied, the spans live as long as the reader. The compressed files of -lz are the
+// exception, they are decompressed on open into memory owned by the reader, numThreads chunks at a time
+class OutputReader {
+public:
+	bool open(const std::string& directory, unsigned int numThreads = 1);
+	void close();
+	const std::string& getError() const { return error; }
+
+	std::span<const PackedVertex> getVertices() const { return vertices; }
+	std::span<const uint32_t> getIndices() const { return indices; }
+	std::span<const DrawElementsIndirectCommand> getCommands() const { return commands; }
+	std::span<const DrawInfo> getDrawInfos() const { return drawInfos; }
+	std::span<const DrawBounds> getBounds() const { return bounds; }
+	std::span<const InstanceTransform> getInstanceTransforms() const { return instanceTransforms; }
+	const std::vector<std::string_view>& getModelNames() const { return modelNames; }
+	std::span<const MaterialRecord> getMaterials() const { return materials; }				// indexed by DrawInfo::materialIndex
+	const std::vector<TextureView>& getTextures() const { return textures; }
+
+	// only with -sh 1, empty otherwise. shadow vertices are 3 floats
+	std::span<const float> getShadowVertices() const { return shadowVertices; }
+	std::span<const uint32_t> getShadowIndices() const { return shadowIndices; }
+	std::span<const DrawElementsIndirectCommand> getShadowCommands() const { return shadowCommands; }
+
+	// raw bytes of one output file / container section by extension ("vbf", "rgb", ...), empty when missing
+	std::span<const std::byte> getSection(const std::string& name) const;
+	bool getSectionLocation(const std::string& name, SectionLocation& location) const;
+
+	// copy src to dst in chunkSize pieces spread over numThreads threads, dst is typically a persistently mapped buffer
+	static void copyParallel(void* dst, std::span<const std::byte> src, unsigned int numThreads, size_t chunkSize = 1 << 22);
+
+	// header and chunk index of a -lz file (dat.vbz / dat.ebz / dat.rgz) once every chunk is checked to lie inside it
+	static bool getCompressedChunks(std::span<const std::byte> compressed, CompressedHeader& header, std::span<const CompressedChunk>& chunks);
+	// decompress every chunk of a -lz file into dst, header.rawSize bytes, spread over numThreads threads
+	static bool decompressParallel(void* dst, std::span<const std::byte> compressed, unsigned int numThreads);
+
+private:
+	std::vector<MappedFile> files;
+	std::vector<std::vector<std::byte>> decompressed;
+	std::map<std::string, std::span<const std::byte>> sections;
+	std::map<std::string, SectionLocation> locations;
+	std::string error;
+
+	std::span<const PackedVertex> vertices;
+	std::span<const uint32_t> indices;
+	std::span<const DrawElementsIndirectCommand> commands;
+	std::span<const DrawInfo> drawInfos;
+	std::span<const DrawBounds> bounds;
+	std::span<const InstanceTransform> instanceTransforms;
+	std::vector<std::string_view> modelNames;
+	std::span<const MaterialRecord> materials;
+	std::vector<TextureView> textures;
+	std::span<const float> shadowVertices;
+	std::span<const uint32_t> shadowIndices;
+	std::span<const DrawElementsIndirectCommand> shadowCommands;
+
+	bool mapContainer(const std::string& path);
+	bool mapFiles(const std::string& directory);
+	bool decompressSection(const std::string& compressedName, const std::string& rawName, unsigned int numThreads);
+	bool parseLoader(std::span<const std::byte> ldr, uint64_t sizeVbf, uint64_t sizeEbf, std::span<const DrawElementsIndirectCommand>& drawCommands,
+		bool readTables);
+	bool parseMaterials();
+	bool parseTextures();
+	bool fail(const std::string& message);
+};
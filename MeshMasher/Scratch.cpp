@@ -0,0 +1,97 @@
+#include "Scratch.h"
+#include <atomic>
+#include <algorithm>
+#include <iterator>
+#include <new>
+
+namespace {
+	const size_t alignment = 16;
+	std::atomic<size_t> scratchAllocations(0), heapAllocations(0), heapBytes(0);
+
+	size_t alignUp(size_t size) { return (size + alignment - 1) & ~(alignment - 1); }
+}
+
+ScratchArena::~ScratchArena() {
+	for (void* ptr : heapBlocks)
+		::operator delete(ptr, std::align_val_t(alignment));
+	::operator delete(block, std::align_val_t(alignment));
+}
+
+void* ScratchArena::allocate(size_t size) {
+	size = alignUp(size == 0 ? 1 : size);
+	peak = std::max(peak, top + size);
+
+	if (top + size > capacity) {
+		heapAllocations.fetch_add(1, std::memory_order_relaxed);
+		heapBytes.fetch_add(size, std::memory_order_relaxed);
+		void* ptr = ::operator new(size, std::align_val_t(alignment));
+		heapBlocks.push_back(ptr);
+		return ptr;
+	}
+
+	scratchAllocations.fetch_add(1, std::memory_order_relaxed);
+	void* ptr = block + top;
+	marks.push_back(top);
+	top += size;
+	return ptr;
+}
+
+void ScratchArena::deallocate(void* ptr) {
+	if (ptr == nullptr)
+		return;
+
+	unsigned char* p = static_cast<unsigned char*>(ptr);
+	if (p >= block && p < block + capacity) {
+		// only the most recent allocation gives its memory back right away
+		if (!marks.empty() && block + marks.back() == p) {
+			top = marks.back();
+			marks.pop_back();
+		}
+		return;
+	}
+
+	auto it = std::find(heapBlocks.rbegin(), heapBlocks.rend(), ptr);
+	if (it != heapBlocks.rend())
+		heapBlocks.erase(std::next(it).base());
+	::operator delete(ptr, std::align_val_t(alignment));
+}
+
+void ScratchArena::reset() {
+	top = 0;
+	marks.clear();
+	for (void* ptr : heapBlocks)
+		::operator delete(ptr, std::align_val_t(alignment));							// left over by callers that rely on reset
+	heapBlocks.clear();
+
+	// grow to what the last task needed so it fits in the block next time
+	if (peak > capacity) {
+		size_t newCapacity = capacity == 0 ? 64 * 1024 : capacity;
+		while (newCapacity < peak)
+			newCapacity *= 2;
+		::operator delete(block, std::align_val_t(alignment));
+		block = static_cast<unsigned char*>(::operator new(newCapacity, std::align_val_t(alignment)));
+		capacity = newCapacity;
+	}
+	peak = 0;
+}
+
+ScratchArena& getScratch() {
+	thread_local ScratchArena scratch;
+	return scratch;
+}
+
+ScratchStats getScratchStats() {
+	ScratchStats stats;
+	stats.scratchAllocations = scratchAllocations.load();
+	stats.heapAllocations = heapAllocations.load();
+	stats.heapBytes = heapBytes.load();
+	return stats;
+}
+
+void* MESHOPTIMIZER_ALLOC_CALLCONV scratchAllocate(size_t size) {
+	return getScratch().allocate(size);
+}
+
+void MESHOPTIMIZER_ALLOC_CALLCONV scratchDeallocate(void* ptr) {
+	getScratch().deallocate(ptr);
+}
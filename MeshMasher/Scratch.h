@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+#include "meshoptimizer.h"
+
+// Per worker bump allocator that persists across tasks and is reset at the start of every task
+// Frees only give memory back when they are the most recent allocation, which matches meshoptimizer's LIFO usage, everything else is reclaimed by reset()
+// When a task needs more than the block holds the allocation falls back to the heap and the block grows to that peak on the next reset
+// Heap fallbacks are tracked too, so reset() frees the ones a task never deallocated
+class ScratchArena {
+public:
+	ScratchArena() : block(nullptr), capacity(0), top(0), peak(0) {}
+	~ScratchArena();
+	ScratchArena(const ScratchArena&) = delete;
+	ScratchArena& operator=(const ScratchArena&) = delete;
+
+	void* allocate(size_t size);
+	void deallocate(void* ptr);
+	void reset();
+
+	template <typename T>
+	T* allocate(size_t count) { return static_cast<T*>(allocate(sizeof(T) * count)); }
+
+private:
+	unsigned char* block;
+	size_t capacity, top, peak;
+	std::vector<size_t> marks;															// start offset of every live block allocation, in order
+	std::vector<void*> heapBlocks;														// live heap fallbacks
+};
+
+struct ScratchStats {
+	size_t scratchAllocations;															// served from a worker block
+	size_t heapAllocations;																// fell back to the global allocator
+	size_t heapBytes;
+};
+
+ScratchArena& getScratch();																// thread local, one per worker
+ScratchStats getScratchStats();
+
+// routed into meshoptimizer with meshopt_setAllocator
+void* MESHOPTIMIZER_ALLOC_CALLCONV scratchAllocate(size_t size);
+void MESHOPTIMIZER_ALLOC_CALLCONV scratchDeallocate(void* ptr);
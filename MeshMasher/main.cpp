@@ -0,0 +1,111 @@
+// main.cpp : Defines the entry point for the application.
+//
+#include "MeshMasher.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// parse an unsigned value within [min, max], anything else is rejected
+bool ParseArgValue(const char* arg, unsigned int min, unsigned int max, unsigned int& value) {
+	char* end = nullptr;
+	unsigned long parsed = strtoul(arg, &end, 10);
+	if (end == arg || *end != '\0' || parsed < min || parsed > max)
+		return false;
+	value = static_cast<unsigned int>(parsed);
+	return true;
+}
+
+void DisplayInvalidArgsMsg() {
+	std::cerr << "Error: Invalid arguments. Arguments should be in the following format:\n";
+	std::cerr << "meshmasher.exe -wt <numWorkerThreads> -ptv <bool 0 / 1> -mo <bool 0 / 1> -sh <bool 0 / 1> -cs <numTriangles> -lpt <bool 0 / 1> -opt <fast / balanced / max / strip> -tb <ms> -rp <bool 0 / 1> -tri <numTriangles> -bt <numTriangles> -ct <bool 0 / 1> -io <sync / uring> -dio <bool 0 / 1> -st <bool 0 / 1> -lz <level>\n";
+	std::cerr << "every argument is optional and can be given in any order\n";
+	std::cerr << "-wt = number of worker threads (1 to 6, default 2)\n";
+	std::cerr << "-ptv = pre transform vertices (aiProcess_PreTransformVertices flag, default 1)\n";
+	std::cerr << "-mo = Use meshoptimizer lib (0 / 1, default 1)\n";
+	std::cerr << "-sh = write position only shadow/depth buffers dat.svb/dat.seb/dat.sdr (0 / 1, default 0)\n";
+	std::cerr << "-cs = meshes above this many triangles are split into chunks processed in parallel, needs -mo 1 (0 = never split, default 1048576)\n";
+	std::cerr << "-lpt = push the tasks of every pass largest estimated cost first instead of in scene order (0 / 1, default 1)\n";
+	std::cerr << "-opt = meshoptimizer preset, fast = fifo cache order without overdraw, balanced = full cache + overdraw above 256 triangles, max = full cache + overdraw on every mesh, strip = strip friendly order + overdraw (default balanced)\n";
+	std::cerr << "-tb = ms of optimization per mesh before its overdraw pass is dropped (0 = no limit, default 0)\n";
+	std::cerr << "-rp = write output/report.json and report.csv with acmr/atvr/overdraw/overfetch before and after optimization (0 / 1, default 0)\n";
+	std::cerr << "-tri = triangle budget of the whole scene, meshes are simplified with the least added error until the scene fits (0 = no budget, default 0)\n";
+	std::cerr << "-bt = meshes of the same model and material below this many triangles are merged into one draw (0 = no batching, default 0)\n";
+	std::cerr << "-ct = write every output file as a page aligned section of the single container output/dat.mmc (0 / 1, default 0)\n";
+	std::cerr << "-io = how dat.vbf/dat.ebf are written, sync = pwrite from every worker, uring = io_uring writes queued by every worker and waited for once (linux only, default sync)\n";
+	std::cerr << "-dio = with -io uring write the page aligned part of dat.vbf/dat.ebf with O_DIRECT, bypassing the page cache (0 / 1, default 0)\n";
+	std::cerr << "-st = stream geometry, write the vertices/indices of every model as soon as it is processed and free them, not with -tri / -ct, always written with pwrite whatever -io / -dio say (0 / 1, default 0)\n";
+	std::cerr << "-lz = write dat.vbf/dat.ebf/dat.rgb as dat.vbz/dat.ebz/dat.rgz, 256 KB chunks compressed in parallel with an lz4 style codec at this level (0 = off, 1 fastest .. 9 smallest, default 0)\n";
+}
+
+int main(int argc, char** argv) {
+	// args = meshmasher.exe -wt <numWorkerThreads> -ptv <bool 0, 1> -mo <bool 0, 1> -sh <bool 0, 1> -cs <numTriangles> -lpt <bool 0, 1> -opt <preset> -tb <ms> -rp <bool 0, 1> -tri <numTriangles> -bt <numTriangles> -ct <bool 0, 1> -io <backend> -dio <bool 0, 1> -st <bool 0, 1> -lz <level>
+	Settings settings;
+	if (argc % 2 == 0) {
+		DisplayInvalidArgsMsg();
+		return 1;
+	}
+
+	for (int i = 1; i < argc; i += 2) {
+		unsigned int value = 0;
+		if (strcmp(argv[i], "-wt") == 0 && ParseArgValue(argv[i + 1], 1, 6, value))
+			settings.numWorkerThreads = value;
+		else if (strcmp(argv[i], "-ptv") == 0 && ParseArgValue(argv[i + 1], 0, 1, value))
+			settings.preTransformVertices = value;
+		else if (strcmp(argv[i], "-mo") == 0 && ParseArgValue(argv[i + 1], 0, 1, value))
+			settings.useMeshOptimizer = value;
+		else if (strcmp(argv[i], "-sh") == 0 && ParseArgValue(argv[i + 1], 0, 1, value))
+			settings.writeShadowData = value;
+		else if (strcmp(argv[i], "-cs") == 0 && ParseArgValue(argv[i + 1], 0, 0xFFFFFFFF, value))
+			settings.chunkTriangles = value;
+		else if (strcmp(argv[i], "-lpt") == 0 && ParseArgValue(argv[i + 1], 0, 1, value))
+			settings.largestFirst = value;
+		else if (strcmp(argv[i], "-opt") == 0 && parseOptLevel(argv[i + 1], settings.optLevel))
+			continue;
+		else if (strcmp(argv[i], "-tb") == 0 && ParseArgValue(argv[i + 1], 0, 0xFFFFFFFF, value))
+			settings.meshTimeBudget = value;
+		else if (strcmp(argv[i], "-rp") == 0 && ParseArgValue(argv[i + 1], 0, 1, value))
+			settings.writeReport = value;
+		else if (strcmp(argv[i], "-tri") == 0 && ParseArgValue(argv[i + 1], 0, 0xFFFFFFFF, value))
+			settings.triangleBudget = value;
+		else if (strcmp(argv[i], "-bt") == 0 && ParseArgValue(argv[i + 1], 0, 0xFFFFFFFF, value))
+			settings.batchTriangles = value;
+		else if (strcmp(argv[i], "-ct") == 0 && ParseArgValue(argv[i + 1], 0, 1, value))
+			settings.writeContainer = value;
+		else if (strcmp(argv[i], "-io") == 0 && parseWriteBackend(argv[i + 1], settings.writeBackend))
+			continue;
+		else if (strcmp(argv[i], "-dio") == 0 && ParseArgValue(argv[i + 1], 0, 1, value))
+			settings.directIo = value;
+		else if (strcmp(argv[i], "-st") == 0 && ParseArgValue(argv[i + 1], 0, 1, value))
+			settings.streamGeometry = value;
+		else if (strcmp(argv[i], "-lz") == 0 && ParseArgValue(argv[i + 1], 0, 9, value))
+			settings.compressionLevel = value;
+		else {
+			DisplayInvalidArgsMsg();
+			return 1;
+		}
+	}
+
+	std::cout << std::boolalpha << "-----****************-----\nMeshMasher Settings :-\nNum Worker Threads : " << settings.numWorkerThreads <<
+		"\nPre Transform Vertices : " << settings.preTransformVertices <<
+		"\nUse MeshOptimizer Lib : " << settings.useMeshOptimizer <<
+		"\nWrite Shadow Data : " << settings.writeShadowData <<
+		"\nChunk Triangles : " << settings.chunkTriangles <<
+		"\nLargest First Scheduling : " << settings.largestFirst <<
+		"\nOptimization Preset : " << getOptLevelName(settings.optLevel) <<
+		"\nMesh Time Budget (ms) : " << settings.meshTimeBudget <<
+		"\nWrite Report : " << settings.writeReport <<
+		"\nTriangle Budget : " << settings.triangleBudget <<
+		"\nBatch Triangles : " << settings.batchTriangles <<
+		"\nWrite Container : " << settings.writeContainer <<
+		"\nWrite Backend : " << getWriteBackendName(settings.writeBackend) <<
+		"\nDirect IO : " << settings.directIo <<
+		"\nStream Geometry : " << settings.streamGeometry <<
+		"\nCompression Level : " << settings.compressionLevel << "\n//chirag\n------****************------\n";
+
+	MeshMasher masher(settings);
+	masher.run();	
+	return 0;
+}
+
+//chirag 2023
+